@@ -5,7 +5,9 @@ struct buf {
   uint blockno;           // 块号
   struct sleeplock lock;  // 读写缓存块耗时会长 用睡眠锁
   uint refcnt;            // 进程的引用数量
+  uint dseq;  // 脏块 已提交还没写回原位置时是提交它的事务序号 否则为0
   struct buf *prev;       // LRU 缓存列表
   struct buf *next;
-  uchar data[BSIZE];  // 缓存大小和块大小一样
+  struct buf *hnext;      // 哈希桶链表 由桶锁保护
+  uchar data[BSIZE];  // 缓存大小和块大小一样 按8字节对齐 位图可以按uint64扫描
 };
\ No newline at end of file
@@ -4,16 +4,24 @@ struct proc;
 struct context;
 struct superblock;
 struct stat;
+struct dirinfo;
+struct iovec;
 struct inode;
 struct pipe;
 
 // bio.c 🎉
 void binit(void);               // 初始化buffer双向链表
 struct buf *bread(uint, uint);  // 给块号 返回带数据的buf
+struct buf *bgetzero(uint, uint);  // 给块号 返回清零的buf 不读磁盘
 void brelse(struct buf *);      // 释放当前buf的锁
 void bwrite(struct buf *);      // 向buf写
 void bpin(struct buf *);        // 增加进程对buf的引用
 void bunpin(struct buf *);      // 减少进程对buf的引用
+void bwrite_async(struct buf *);  // 开始写回buf 不等待
+void bwritev_async(struct buf **, int);  // 开始写回一组buf 块号连续的合成一个请求
+void bwait(struct buf *);         // 等待buf的磁盘请求完成
+void *breclaim(void);           // 内存紧张时回收一页空闲的buf
+void breadahead(uint, uint, int);  // 异步预读连续的几个块到缓存
 
 // console.c 🎉
 void consoleinit();  // 初始化控制台设备
@@ -100,6 +108,7 @@ int either_copyout(int user_dst, uint64 dst, void *src,
 int either_copyin(void *dst, int user_src, uint64 src,
                   uint64 len);  // 从内核或者用户拷贝出
 void procdump(void);            // 打印当前进程列表信息 调试用
+int kthread_create(char *, void (*)(void));  // 创建一个内核线程
 
 // trap.c 🎉
 void trapinit(void);               // 初始化陷入
@@ -123,10 +132,13 @@ int holdingsleep(struct sleeplock *);  // 查询锁的持有状态
 // fs.c 🎉
 void fsinit(int);  // 初始化文件系统 由第一个进程调用 因为用到了睡眠锁
 int dirlink(struct inode *, char *, uint);
+int dirunlink(struct inode *, char *, uint);  // 清掉目录里的一项
+int dirread(struct inode *, uint *, struct dirinfo *, struct inode **, int);
 struct inode *dirlookup(struct inode *, char *, uint *);
 struct inode *ialloc(uint, short);   // 分配inode到磁盘
 struct inode *idup(struct inode *);  // inode引用次数自增
 void iinit();                        // 初始化内存inode表
+void *ireclaim(void);                // 内存紧张时回收一页没被引用的inode
 void ilock(struct inode *);          // 锁定inode
 void iput(struct inode *);           // 减少inode引用
 void iunlock(struct inode *);        // 解锁inode
@@ -136,6 +148,7 @@ int namecmp(const char *, const char *);
 struct inode *namei(char *);
 struct inode *nameiparent(char *, char *);
 int readi(struct inode *, int, uint64, uint, uint);  // 从inode里面读内容
+struct buf *ibread(struct inode *, uint);  // 读文件的一个块 返回缓存里的buf
 void stati(struct inode *, struct stat *);           // 修改stat的状态
 int writei(struct inode *, int, uint64, uint, uint);
 void itrunc(struct inode *);  // 舍弃inode
@@ -148,12 +161,20 @@ void fileinit(void);                          // 文件表初始化
 int fileread(struct file *, uint64, int n);   // 文件读
 int filestat(struct file *, uint64 addr);     // 读stat到用户空间
 int filewrite(struct file *, uint64, int n);  // 文件写
+int filereadv(struct file *, struct iovec *, int, uint *);   // 分段读
+int filewritev(struct file *, struct iovec *, int, uint *);  // 分段写
+int filesend(struct file *, struct file *, int);  // 在内核里从文件送数据
+int filegetdents(struct file *, uint64, int n);  // 读文件夹项到用户空间
 
 // log.c 🎉
 void initlog(int, struct superblock *);  // 事务初始化
 void log_write(struct buf *);            // 写块 记录日志
+void log_data(struct buf *);             // 写文件数据块 有序模式下不进日志
 void begin_op(void);                     // 操作开始
 void end_op(void);                       // 操作结束
+void begin_opn(int);                     // 操作开始 预留指定的日志块数
+int log_maxop(void);                     // 单个操作最多能预留的日志块数
+void log_sync(void);                     // 等已经结束的操作都落盘
 
 // swtch.S 🎉
 void swtch(struct context *, struct context *);  // 内核进程上下文切换
@@ -161,6 +182,9 @@ void swtch(struct context *, struct context *);  // 内核进程上下文切换
 // virtio_disk.c 🎉
 void virtio_disk_init(void);
 void virtio_disk_rw(struct buf *, int);
+void virtio_disk_submit(struct buf *, int, void (*)(struct buf *));
+void virtio_disk_submitv(struct buf **, int, int, void (*)(struct buf *));
+void virtio_disk_wait(struct buf *);
 void virtio_disk_intr(void);
 
 // syscall.c 🎉
@@ -179,6 +203,8 @@ int pipealloc(struct file **, struct file **);
 void pipeclose(struct pipe *, int);
 int piperead(struct pipe *, uint64, int);
 int pipewrite(struct pipe *, uint64, int);
+int pipeput(struct pipe *, char *, int);  // 不睡眠 放进管道能放下的部分
+int pipewait(struct pipe *);              // 等管道有空位
 
 // 固定大小的数组 返回元素数 🎉
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
\ No newline at end of file
@@ -3,3 +3,9 @@
 #define O_RDWR 0x002
 #define O_CREATE 0x200
 #define O_TRUNC 0x400
+
+// readv和writev的一个段
+struct iovec {
+  void *base;  // 缓冲区地址
+  uint len;    // 缓冲区大小
+};
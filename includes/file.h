@@ -16,11 +16,31 @@ struct inode {
   struct sleeplock lock;  // 保护读写inode
   int valid;              // inode是否被读入
   short type;             // 文件类型
+  short flags;            // inode的选项 I_开头的位
   short major;            // 设备号主
   short minor;            // 设备号次
   short nlink;            // 硬链接数
   uint size;              // 文件大小
-  uint addrs[NDIRECT + 1];  // 映射地址 前12个直接映射 第13个间接映射
+  uint addrs[NDIRECT + NLEVEL];  // 映射地址 前10个直接映射 后3个是各级间接映射
+  // 顺序读的预读状态 由lock保护
+  uint ranext;  // 顺序读的话 下一次读从这个块开始
+  uint rawin;   // 预读窗口 顺序读一直持续就翻倍
+  uint raend;   // 已经预读到了哪个块 不含
+  // 最近查过的最底层间接块里一段映射的副本 由lock保护
+  // 顺序访问时不用每个块都把间接块bread一遍
+  uint mapbn;            // map[0]对应的文件块号
+  uint mapn;             // map里的有效项数 0表示缓存为空
+  uint map[NMAPCACHE];   // 文件块号mapbn开始的块号 0表示还没分配
+  // 按区段映射的inode 缓存最近命中的区段 由lock保护
+  uint extbn;    // 区段的第一个块在文件里的块号
+  uint extaddr;  // 区段的第一个块在磁盘上的块号
+  uint extlen;   // 区段的长度 0表示缓存为空
+  uint goal;     // 下次给这个inode分配块时从这个块号开始找 0表示没有
+  uint dirfree;  // 目录在这个偏移之前的项都在用 dirlink从这里开始找空位
+  // 由itable.lock保护
+  struct inode *prev;   // LRU链表
+  struct inode *next;
+  struct inode *hnext;  // 哈希桶链表
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
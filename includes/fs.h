@@ -1,7 +1,7 @@
 #define ROOTINO 1   // 根目录的inode number是1
 #define BSIZE 1024  // 块大小是1024Byte
 
-// 启动区 | superblock | 日志区 | inode区 | 空闲位 | 数据区
+// 启动区 | superblock | 日志区 | inode区 | inode位图 | 空闲位 | 数据区
 // 超级快
 struct superblock {
   uint magic;       // 文件系统魔法标识
@@ -12,29 +12,64 @@ struct superblock {
   uint logstart;    // 第一个日志块的块号
   uint inodestart;  // 第一个inode区的块号
   uint bmapstart;   // 第一个位图区的块号
+  uint flags;       // 文件系统的选项 FS_开头的位
+  uint imapstart;   // 第一个inode位图块的块号
 };
 
 // paddle-fs的魔术标识
 #define FSMAGIC 0x00627778
 
-// 直接映射数量是12
-#define NDIRECT 12
+// 有序日志模式 文件数据不进日志 在元数据提交之前直接写回原位置
+// 没有这个位的话 文件数据和元数据一样写两遍
+#define FS_ORDERED 0x1
+
+// 直接映射数量是10
+#define NDIRECT 10
 // 间接文件索引块 每个索引值是一个uint 每个块可以管理256个索引号
 #define NINDIRECT (BSIZE / sizeof(uint))
-// 单文件最大是 268个block 也就是268KB
-#define MAXFILE (NDIRECT + NINDIRECT)
+// 内存inode缓存最底层间接块里的多少项映射 要能整除NINDIRECT
+#define NMAPCACHE 32
+// 间接映射的级数 一级 二级 三级各占addrs里的一项
+#define NLEVEL 3
+// 单文件最多 10 + 256 + 256^2 + 256^3 个block
+// 超过了uint能表示的4GB 实际受size字段限制
+#define MAXFILE                                                  \
+  (NDIRECT + NINDIRECT + NINDIRECT * NINDIRECT +                 \
+   NINDIRECT * NINDIRECT * NINDIRECT)
 
 // 文件系统中的inode结构
 struct dinode {
-  short type;   // 文件类型
+  uchar type;   // 文件类型
+  uchar flags;  // inode的选项 I_开头的位
   short major;  // 主设备号
   short minor;  // 辅设备号
   short nlink;  // 当前inode被多少个文件夹引用 多少个硬链接
   uint size;    // 文件大小 单位字节
-  // 数据区块块号 按顺序排列 最后一位是间接文件索引块的块号
-  uint addrs[NDIRECT + 1];
+  // 数据区块块号 前NDIRECT个直接映射
+  // 后面依次是一级 二级 三级间接文件索引块的块号
+  uint addrs[NDIRECT + NLEVEL];
+};
+
+// addrs不按块映射 而是按区段映射
+// 前NIEXT个区段直接放在addrs里 addrs的最后一项是区段块的块号
+// 区段块里再放NEXTPB个区段 区段按文件里的顺序排列 len为0表示后面没有了
+// 区段用完以后 后面的块按块映射 区段块最后一项的start是一棵NLEVEL-1级间接映射树的根
+#define I_EXTENT 0x1
+
+// 区段 磁盘上从start开始连续的len个块
+struct extent {
+  uint start;
+  uint len;
 };
 
+// inode里能直接放几个区段
+#define NIEXT ((NDIRECT + NLEVEL - 1) / 2)
+// addrs里区段块的位置
+#define EXTBLK (NDIRECT + NLEVEL - 1)
+// 一个区段块能放几个区段 最后一项留给按块映射的树根
+#define NEXTPB (BSIZE / sizeof(struct extent) - 1)
+#define ETAIL NEXTPB
+
 // 每一个block可以放多少个dinode
 // 1024 / 64 = 16个
 #define IPB (BSIZE / sizeof(struct dinode))
@@ -58,3 +93,38 @@ struct dirent {
   ushort inum;        // 该文件夹索引指向哪个inode
   char name[DIRSIZ];  // 当前的目录名
 };
+
+// 项多于一个块的文件夹用哈希索引 inode的flags里带I_HTREE
+// 第0块的前两项是.和.. 后面的项放索引 这些项的inum都是0
+// 按顺序读文件夹的程序会把它们当作空项跳过 所以还是能当普通文件夹读
+// 索引把名字哈希值的低depth位映射到一个块 名字只会存在这个块里
+// 其余的块都是普通的dirent数组 一个块满了就分裂成两个 必要时索引翻倍
+#define I_HTREE 0x2
+
+// 一个索引项里放几个块号
+#define HTPS 7
+
+// 第0块里的索引项 和dirent一样大
+struct htslot {
+  ushort inum;       // 总是0
+  ushort blk[HTPS];  // 文件夹里的块号
+};
+
+// 索引最多用哈希值的几位 2^HTMAXDEPTH个块号要能放进第0块
+#define HTMAXDEPTH 8
+
+// 第0块data里索引的第k个数 k为0是depth 哈希值低位为i的名字在第i+1个数指的块里
+#define HTENT(data, k) \
+  (((struct htslot *)(data) + 2 + (k) / HTPS)->blk[(k) % HTPS])
+
+// 文件夹项名字的哈希 FNV-1a
+static inline uint dirhash(const char *name) {
+  uint h;
+  int i;
+
+  h = 2166136261u;
+  for (i = 0; i < DIRSIZ && name[i] != 0; i++) {
+    h = (h ^ (uchar)name[i]) * 16777619u;
+  }
+  return h;
+}
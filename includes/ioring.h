@@ -0,0 +1,44 @@
+// 异步系统调用的共享环
+// 进程在自己的一页内存里放一个ioring 用ioring_setup登记
+// 往提交队列里放请求 调一次ioring_enter 内核把请求都做完 结果放进完成队列
+// 一次陷入可以做很多个读写 不用每个请求都进出一次内核
+
+// 提交队列和完成队列的项数 必须是2的幂
+#define NSQE 64
+#define NCQE 64
+
+// 请求的操作 结果和对应系统调用的返回值一样
+#define IO_READ 1   // read或者pread
+#define IO_WRITE 2  // write或者pwrite
+#define IO_OPEN 3   // open addr是路径 len是模式
+#define IO_CLOSE 4  // close
+#define IO_FSYNC 5  // 等之前的写都落盘
+
+// 提交队列的项
+struct sqe {
+  int op;       // IO_开头的操作
+  int fd;       // 文件描述符
+  uint64 addr;  // 缓冲区或者路径的地址
+  int len;      // 读写的大小 open时是模式
+  int off;      // 读写的偏移 -1表示用文件当前的偏移并移动它
+  uint64 data;  // 用户的标记 原样放进完成项
+};
+
+// 完成队列的项
+struct cqe {
+  uint64 data;  // 提交时的标记
+  int res;      // 结果
+  int pad;
+};
+
+// 头和尾一直往上加 取余得到下标
+// 提交队列 用户放请求移动sqtail 内核取走移动sqhead
+// 完成队列 内核放结果移动cqtail 用户取走移动cqhead
+struct ioring {
+  uint sqhead;
+  uint sqtail;
+  uint cqhead;
+  uint cqtail;
+  struct sqe sq[NSQE];
+  struct cqe cq[NCQE];
+};
@@ -7,18 +7,75 @@
 // 进程最大数
 #define NPROC 64
 
-// 文件系统可操作的最大文件块数
+// 普通文件系统操作在日志里预留的块数
+// 大的写操作用begin_opn按需预留
 #define MAXOPBLOCKS 10
 
-// 日志块大小
-#define LOGSIZE (MAXOPBLOCKS * 3)
+// 往文件夹里加项的操作一次dirlink最多分裂几次哈希索引的块
+#define NHTSPLIT 2
 
-// 磁盘buffer的大小
+// 往文件夹里加项的操作预留的块数
+// 新inode 它的目录块 inode位图 块位图 父目录的inode和索引块
+// 父目录的三级间接块 加上每次分裂的旧块和新块
+#define DIROPBLOCKS (1 + 1 + 1 + 1 + 1 + 1 + 3 + 2 * NHTSPLIT)
+
+// 日志的一半要能同时放下几个普通操作的预留
+#define LOGOPS 4
+
+// mkfs建的日志区大小 内核挂载时以superblock里的nlog为准
+// 分成两半 每一半是一个header块加上LOGOPS个操作的预留
+#define LOGSIZE (2 * (1 + LOGOPS * MAXOPBLOCKS))
+
+// 内核支持的日志区最多能放多少个数据块
+#define LOGMAX 1024
+
+// 日志线程的提交条件 事务攒到日志区的1/LOGFLUSHFRAC
+#define LOGFLUSHFRAC 2
+
+// 或者事务从第一个块开始已经过了这么多个tick
+#define LOGFLUSHTICKS 2
+
+// 提交过了这么多个tick 写回线程就把记录里的脏块写回原位置
+#define LOGWBTICKS 10
+
+// 磁盘buffer的大小 缓存按需从kalloc的页里增长
+// 内存紧张时回收 但至少保留NBUF个
 #define NBUF (MAXOPBLOCKS * 3)
 
-// 最大的活跃的inode数量 加载到内存中的Inode数
+// 磁盘buffer的上限 到达上限且都被引用时 bget睡眠等待
+#define NBUFMAX 2048
+
+// 一次磁盘请求最多带多少个块号连续的块 要小于virtio的描述符数减2
+#define NCLUSTER 64
+
+// 顺序读的预读窗口 从RAMIN个块开始翻倍 最多RAMAX个块
+#define RAMIN 4
+#define RAMAX 64
+
+// buffer哈希桶的数量 取质数让块号分布均匀
+#define NBUCKET 13
+
+// 内存inode表按需从kalloc的页里增长 内存紧张时回收 但至少保留NINODE个
 #define NINODE 50
 
+// 内存inode表的上限 到达上限时替换最久没用的没被引用的inode
+#define NINODEMAX 1000
+
+// inode哈希桶的数量
+#define NIBUCKET 31
+
+// 目录项缓存的项数 路径解析先查这里 查不到才读目录
+#define NDCACHE 128
+
+// 目录项缓存哈希桶的数量
+#define NDBUCKET 61
+
+// readv和writev最多的段数
+#define NIOV 16
+
+// getdents在文件夹的锁下一次取多少项
+#define NGETDENTS 8
+
 // 系统最多可以打开文件数
 #define NFILE 100
 
@@ -98,4 +98,7 @@ struct proc {
   struct context context;       // swtch在这里保存内核态上下文
   struct file *ofile[NOFILE];   // 打开的文件
   struct inode *cwd;            // 进程当前的文件夹
+  void (*kfn)(void);            // 内核线程要执行的函数 普通进程为0
+  int logrsv;                   // 当前文件系统操作在日志里预留的块数
+  uint64 ioring;                // 登记的共享环的用户地址 0表示没有
 };
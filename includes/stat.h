@@ -11,3 +11,12 @@ struct stat {
   short nlink;  // 硬链接数
   uint64 size;  // 文件大小
 };
+
+// getdents返回的文件夹项 带上了文件的类型和大小
+struct dirinfo {
+  uint ino;      // inode号
+  short type;    // 类型
+  short nlink;   // 硬链接数
+  uint64 size;   // 文件大小
+  char name[16];  // 文件名 以0结尾
+};
@@ -20,3 +20,11 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_getdents 22
+#define SYS_pread  23
+#define SYS_pwrite 24
+#define SYS_readv  25
+#define SYS_writev 26
+#define SYS_ioring_setup 27
+#define SYS_ioring_enter 28
+#define SYS_sendfile 29
@@ -39,6 +39,7 @@
 // device feature bits
 #define VIRTIO_BLK_F_RO              5	/* Disk is read-only */
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
+#define VIRTIO_BLK_F_FLUSH           9	/* Cache flush command support */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ             12	/* support more than one vq */
 #define VIRTIO_F_ANY_LAYOUT         27
@@ -47,7 +48,10 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// each disk request uses a chain of a header, one descriptor
+// per block, and a status byte, so a single-block request
+// takes three and a full NCLUSTER request takes NCLUSTER + 2.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
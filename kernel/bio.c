@@ -8,79 +8,277 @@
 #include "includes/buf.h"
 #include "includes/defs.h"
 
+// 根据设备号和块号算出哈希桶
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// 一个物理页能放几个buf 缓存以页为单位增长和回收
+#define BPP ((int)(PGSIZE / sizeof(struct buf)))
+
+// 哈希桶 每个桶一把锁 查找缓存块只需要拿对应的桶锁
+struct bucket {
+  struct spinlock lock;  // 保护桶链表和桶内buf的refcnt
+  struct buf *head;      // 单向链表 用buf的hnext串起来
+};
+
 struct {
-  struct spinlock lock;  // 操作缓存双向链表是原子的
-  // 循环链表
-  struct buf buf[NBUF];  // 利用CPU的三缓 程序的局部性
+  struct spinlock lock;  // 保护LRU双向链表和nbuf 同时串行化缓存块的替换
+  int nbuf;              // 当前缓存的buf数量
 
-  // 链表头
+  // LRU链表头 head.next是最近释放的 head.prev是最久没用的
+  // 所有buf都在这个链表上
   struct buf head;
+
+  struct bucket bucket[NBUCKET];
 } bcache;
 
 void binit(void) {
-  struct buf* b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for (i = 0; i < NBUCKET; i++) {
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    bcache.bucket[i].head = 0;
+  }
 
-  // 创建双向循环链表
+  // 创建空的双向循环链表 buf在用到的时候再分配
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  bcache.nbuf = 0;
+  printf("block buffer linked list init:\t done!\n");
+}
+
+// 在桶里查找块 调用者持有桶锁
+static struct buf* blookup(struct bucket* bkt, uint dev, uint blockno) {
+  struct buf* b;
+
+  for (b = bkt->head; b != 0; b = b->hnext) {
+    if (b->dev == dev && b->blockno == blockno) {
+      return b;
+    }
+  }
+  return 0;
+}
+
+// 从桶中摘掉buf 调用者持有桶锁
+static void bunhash(struct bucket* bkt, struct buf* b) {
+  struct buf** pp;
+
+  for (pp = &bkt->head; *pp != 0; pp = &(*pp)->hnext) {
+    if (*pp == b) {
+      *pp = b->hnext;
+      b->hnext = 0;
+      return;
+    }
+  }
+  panic("bunhash");
+}
+
+// 从LRU链表中摘掉buf 调用者持有bcache.lock
+static void blruremove(struct buf* b) {
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// 分配一个页 切成BPP个buf加入缓存
+// 新buf的设备号和块号都是0 挂在对应的桶里 放在LRU尾部最先被使用
+// 这样每个buf始终在它的(dev, blockno)所对应的桶中
+// 返回0说明没有内存了
+static int bgrow(void) {
+  struct buf *page, *b;
+  struct bucket* bkt0 = &bcache.bucket[BHASH(0, 0)];
+
+  // kalloc可能会回收缓存 所以不能拿着bcache的锁调用
+  if ((page = (struct buf*)kalloc()) == 0) {
+    return 0;
+  }
+  memset(page, 0, PGSIZE);
+
+  acquire(&bcache.lock);
+  if (bcache.nbuf >= NBUFMAX) {
+    // 别的进程已经扩到上限了
+    release(&bcache.lock);
+    kfree(page);
+    return 1;
+  }
+  acquire(&bkt0->lock);
+  for (b = page; b < page + BPP; b++) {
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->hnext = bkt0->head;
+    bkt0->head = b;
+    b->prev = bcache.head.prev;
+    b->next = &bcache.head;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
   }
-  printf("block buffer linked list init:\t done!\n");
+  bcache.nbuf += BPP;
+  release(&bkt0->lock);
+  release(&bcache.lock);
+  return 1;
+}
+
+// 内存紧张的时候 由kalloc调用 交出一个所有buf都没被引用的页
+// 缓存至少保留NBUF个buf
+// 调用者不能持有任何自旋锁 返回交出的页 没有可回收的页时返回0
+void* breclaim(void) {
+  struct buf *b, *page, *x;
+  struct bucket *bkt, *bkt0 = &bcache.bucket[BHASH(0, 0)];
+  int busy;
+
+  acquire(&bcache.lock);
+  // 从最久没用的开始找
+  for (b = bcache.head.prev; b != &bcache.head && bcache.nbuf - BPP >= NBUF;
+       b = b->prev) {
+    if (b->refcnt != 0) {
+      continue;
+    }
+    page = (struct buf*)PGROUNDDOWN((uint64)b);
+    // 把同一页的buf都认领下来 改成无效的(0, 0)块
+    // 持有bcache.lock时别人无法替换它们 查找也不会再命中它们
+    busy = 0;
+    for (x = page; x < page + BPP; x++) {
+      bkt = &bcache.bucket[BHASH(x->dev, x->blockno)];
+      acquire(&bkt->lock);
+      if (x->refcnt != 0) {
+        busy = 1;
+        release(&bkt->lock);
+        break;
+      }
+      if (bkt != bkt0) {
+        bunhash(bkt, x);
+        release(&bkt->lock);
+        acquire(&bkt0->lock);
+        x->hnext = bkt0->head;
+        bkt0->head = x;
+      }
+      x->dev = 0;
+      x->blockno = 0;
+      x->valid = 0;
+      release(&bkt0->lock);
+    }
+    if (busy) {
+      // 已经认领的buf还留在缓存里 只是内容作废了
+      continue;
+    }
+    // 整页都空闲 从桶和LRU链表中摘掉
+    acquire(&bkt0->lock);
+    for (x = page; x < page + BPP; x++) {
+      bunhash(bkt0, x);
+      blruremove(x);
+    }
+    release(&bkt0->lock);
+    bcache.nbuf -= BPP;
+    release(&bcache.lock);
+    return page;
+  }
+  release(&bcache.lock);
+  return 0;
 }
 
 // 在特定设备查找缓存链表
 // 没找到的话 分配缓存块
 // 返回的buf是上锁的
-static struct buf* bget(uint dev, uint blockno) {
+// nowait为1的时候 所有buf都被引用了就返回0 不睡眠等待
+static struct buf* bget(uint dev, uint blockno, int nowait) {
   struct buf* b;
+  struct bucket* bkt = &bcache.bucket[BHASH(dev, blockno)];
+  struct bucket* old;
+  int nomem = 0;
+  int grow;
+
+  // 查找当前块是不是已经被缓存了 命中时只碰一个桶锁
+  acquire(&bkt->lock);
+  if ((b = blookup(bkt, dev, blockno)) != 0) {
+    // 找到了
+    b->refcnt++;
+    release(&bkt->lock);
+    // 对buffer块上锁
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bkt->lock);
+
+  // 没缓存
+  // 拿全局锁串行化替换 锁的顺序总是先全局锁再桶锁
   acquire(&bcache.lock);
+  while (1) {
+    acquire(&bkt->lock);
 
-  // 查找当前块是不是已经被缓存了
-  for (b = bcache.head.next; b != &bcache.head; b = b->next) {
-    if (b->dev == dev && b->blockno == blockno) {
-      // 找到了
+    // 放掉桶锁的间隙里 别的进程可能已经把这个块放进缓存了
+    if ((b = blookup(bkt, dev, blockno)) != 0) {
       b->refcnt++;
+      release(&bkt->lock);
       release(&bcache.lock);
-      // 对buffer块上锁
       acquiresleep(&b->lock);
       return b;
     }
-  }
 
-  // 没缓存
-  // 循环更新LRU块
-  // 倒着查
-  for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-    if (b->refcnt == 0) {
-      // 找到了没被用的块
-      b->dev = dev;
-      b->blockno = blockno;
-      // 暂时没内容 所以是0
-      b->valid = 0;
-      b->refcnt = 1;
+    // 从LRU链表尾部倒着查 找没被引用的块
+    // 只有持有全局锁的进程才会同时拿两个桶锁 所以不会死锁
+    grow = 0;
+    for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
+      old = &bcache.bucket[BHASH(b->dev, b->blockno)];
+      if (old != bkt) {
+        acquire(&old->lock);
+      }
+      if (b->refcnt == 0) {
+        if (b->valid && bcache.nbuf < NBUFMAX && !nomem) {
+          // 要替换掉有数据的块 还没到上限就先扩大缓存
+          grow = 1;
+        } else {
+          // 找到了空的或者可以替换的块 挪到新的桶里
+          if (old != bkt) {
+            bunhash(old, b);
+            release(&old->lock);
+            b->hnext = bkt->head;
+            bkt->head = b;
+          }
+          b->dev = dev;
+          b->blockno = blockno;
+          // 暂时没内容 所以是0
+          b->valid = 0;
+          b->refcnt = 1;
+          release(&bkt->lock);
+          release(&bcache.lock);
+          acquiresleep(&b->lock);
+          return b;
+        }
+      }
+      if (old != bkt) {
+        release(&old->lock);
+      }
+      if (grow) {
+        break;
+      }
+    }
+    release(&bkt->lock);
+
+    if (bcache.nbuf < NBUFMAX && !nomem) {
+      // 新的buf在LRU尾部 扩大之后重新找一遍
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      nomem = !bgrow();
+      acquire(&bcache.lock);
+      continue;
     }
+
+    // 所有buf都被引用了 到上限了或者没内存了 等别的进程brelse
+    if (nowait) {
+      release(&bcache.lock);
+      return 0;
+    }
+    sleep(&bcache, &bcache.lock);
+    nomem = 0;
   }
-  panic("bget: no buffers");
 }
 
 // 返回一个带数据的buf
 struct buf* bread(uint dev, uint blockno) {
   struct buf* b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if (!b->valid) {
     // 读入到buf
-    virtio_disk_rw(b, 0);
+    virtio_disk_submit(b, 0, 0);
+    virtio_disk_wait(b);
     // 标记为有效位！
     b->valid = 1;
   }
@@ -88,30 +286,137 @@ struct buf* bread(uint dev, uint blockno) {
   return b;
 }
 
+// 返回一个内容全是0的buf 不读磁盘
+// 给新分配的块用 原来的内容反正要被覆盖
+struct buf* bgetzero(uint dev, uint blockno) {
+  struct buf* b;
+
+  b = bget(dev, blockno, 0);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+static void bput(struct buf* b, int lru);
+
+// 预读的块读完之后 在磁盘中断里调用
+// 中断里没有进程 不能用brelse检查持有者 直接放锁和引用
+static void bradone(struct buf* b) {
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b, 1);
+}
+
+// 预读用 块不在缓存里的话返回拿着睡眠锁的空buf 否则返回0
+// nowait为1时缓存满了也返回0 不预读这个块
+static struct buf* bgetra(uint dev, uint blockno, int nowait) {
+  struct buf* b;
+  struct bucket* bkt = &bcache.bucket[BHASH(dev, blockno)];
+
+  acquire(&bkt->lock);
+  b = blookup(bkt, dev, blockno);
+  release(&bkt->lock);
+  if (b != 0) {
+    return 0;
+  }
+
+  b = bget(dev, blockno, nowait);
+  if (b == 0) {
+    return 0;
+  }
+  if (b->valid) {
+    // 拿锁的时候别人已经读进来了
+    brelse(b);
+    return 0;
+  }
+  return b;
+}
+
+// 预读 把从blockno开始的n个块异步读进缓存 不等磁盘就返回
+// 已经在缓存里的块直接跳过 其余块号连续的块合成一个磁盘请求
+// 读完之前别人bread这些块会等在睡眠锁上
+void breadahead(uint dev, uint blockno, int n) {
+  struct buf* run[NCLUSTER];
+  struct buf* b;
+  int i, k;
+
+  k = 0;
+  for (i = 0; i < n; i++) {
+    // 手里拿着还没提交的buf时不能等别人brelse 缓存小的时候会等不到
+    if ((b = bgetra(dev, blockno + i, k > 0)) != 0) {
+      run[k++] = b;
+    }
+    // 在缓存里的块把连续的一段断开
+    if (k > 0 && (b == 0 || k == NCLUSTER || i == n - 1)) {
+      virtio_disk_submitv(run, k, 0, bradone);
+      k = 0;
+    }
+  }
+}
+
 // 写回buf的内容到磁盘
 // buf的睡眠锁要是持有状态
 void bwrite(struct buf* b) {
+  bwrite_async(b);
+  bwait(b);
+}
+
+// 开始写回buf 不等磁盘完成就返回
+// 可以连着提交多个buf 让磁盘队列一直有活干
+// 调用者在brelse之前必须bwait
+void bwrite_async(struct buf* b) {
   // 写回的时候 必须有进程拿着buf的睡眠锁
   if (!holdingsleep(&b->lock)) {
     panic("bwrite");
   }
-  virtio_disk_rw(b, 1);
+  virtio_disk_submit(b, 1, 0);
 }
 
-// 释放这个buffer的睡眠锁
-// 放到LRU的头
-void brelse(struct buf* b) {
-  if (!holdingsleep(&b->lock)) {
-    panic("brelse");
+// 开始写回n个buf 不等磁盘完成就返回
+// 块号连续的一段合成一个磁盘请求 最多NCLUSTER个块
+// 调用者拿着所有buf的睡眠锁 在brelse之前对每个buf都要bwait
+void bwritev_async(struct buf** bs, int n) {
+  int i, k;
+
+  for (i = 0; i < n; i += k) {
+    if (!holdingsleep(&bs[i]->lock)) {
+      panic("bwritev");
+    }
+    for (k = 1; i + k < n && k < NCLUSTER &&
+                bs[i + k]->blockno == bs[i]->blockno + k;
+         k++) {
+      if (!holdingsleep(&bs[i + k]->lock)) {
+        panic("bwritev");
+      }
+    }
+    virtio_disk_submitv(bs + i, k, 1, 0);
   }
-  releasesleep(&b->lock);
+}
+
+// 等待buf上的磁盘请求完成
+void bwait(struct buf* b) { virtio_disk_wait(b); }
+
+// 减少一个引用 由bunpin和brelse使用
+// 如果是最后一个引用 先挪到LRU的头再清零
+// 这样替换和回收看到refcnt为0的时候 没有人还在碰这个buf
+static void bput(struct buf* b, int lru) {
+  struct bucket* bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  // 引用数由桶锁保护
+  acquire(&bkt->lock);
+  if (b->refcnt > 1) {
+    // 还有别人在用 不用碰全局锁
+    b->refcnt--;
+    release(&bkt->lock);
+    return;
+  }
+  release(&bkt->lock);
+
   // 要读写链表了
   acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
+  if (lru) {
     // 连接b的前后
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
+    blruremove(b);
     // 修改b自身的前后指向
     b->next = bcache.head.next;
     b->prev = &bcache.head;
@@ -119,18 +424,34 @@ void brelse(struct buf* b) {
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
+  acquire(&bkt->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // 可能有bget在等空闲的buf
+    wakeup(&bcache);
+  }
+  release(&bkt->lock);
   release(&bcache.lock);
 }
 
+// 释放这个buffer的睡眠锁
+// 放到LRU的头
+void brelse(struct buf* b) {
+  if (!holdingsleep(&b->lock)) {
+    panic("brelse");
+  }
+  releasesleep(&b->lock);
+  bput(b, 1);
+}
+
 // 增减进程对buf的引用数
+// 调用者保证buf已经被引用 块号不会变 所以桶是确定的
 void bpin(struct buf* b) {
-  acquire(&bcache.lock);
+  struct bucket* bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bkt->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
-void bunpin(struct buf* b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
-}
+void bunpin(struct buf* b) { bput(b, 0); }
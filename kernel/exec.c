@@ -183,6 +183,8 @@ int exec(char *path, char **argv) {
   // 上面新开的页表
   p->pagetable = pagetable;
   p->sz = sz;
+  // 共享环在老的地址空间里
+  p->ioring = 0;
   // 程序入口虚拟地址
   p->trapframe->epc = elf.entry;
   // 用户栈 sp当前指向的是 放置argc和argv完之后的地址 其余空白的地址都是用户栈
@@ -3,8 +3,10 @@
 #include "includes/sleeplock.h"
 #include "includes/riscv.h"
 #include "includes/fs.h"
+#include "includes/buf.h"
 #include "includes/file.h"
 #include "includes/stat.h"
+#include "includes/fcntl.h"
 #include "includes/defs.h"
 #include "includes/params.h"
 #include "includes/proc.h"
@@ -99,76 +101,320 @@ int filestat(struct file* f, uint64 addr) {
   return -1;
 }
 
+// 读文件夹项到用户空间 addr指向dirinfo数组 最多读n项
+// 每次在文件夹的锁下取一批项并拿着它们的inode引用 解锁之后再逐个读类型和大小
+// 这样不会同时锁住文件夹和它的..
+int filegetdents(struct file* f, uint64 addr, int n) {
+  struct proc* p = myproc();
+  struct dirinfo di[NGETDENTS];
+  struct inode* ips[NGETDENTS];
+  struct stat st;
+  int tot, k, i;
+  uint off;
+
+  if (f->type != FD_INODE || f->readable == 0) {
+    return -1;
+  }
+  for (tot = 0; tot < n; tot += k) {
+    ilock(f->ip);
+    off = f->off;
+    k = dirread(f->ip, &f->off, di, ips,
+                n - tot < NGETDENTS ? n - tot : NGETDENTS);
+    iunlock(f->ip);
+    if (k < 0) {
+      return tot > 0 ? tot : -1;
+    }
+    if (k == 0) {
+      break;
+    }
+    // 项可能在这期间被删掉 最后一个iput要释放inode 所以放在事务里
+    begin_op();
+    for (i = 0; i < k; i++) {
+      ilock(ips[i]);
+      stati(ips[i], &st);
+      iunlockput(ips[i]);
+      di[i].type = st.type;
+      di[i].nlink = st.nlink;
+      di[i].size = st.size;
+    }
+    end_op();
+    // 拷不出去的这几项没交给用户 偏移退回去 下次还从这里读
+    // 前面已经拷出去的项照样算数
+    if (copyout(p->pagetable, addr + tot * sizeof(di[0]), (char*)di,
+                k * sizeof(di[0])) < 0) {
+      ilock(f->ip);
+      f->off = off;
+      iunlock(f->ip);
+      return tot > 0 ? tot : -1;
+    }
+  }
+  return tot;
+}
+
+// 开始一个写文件的事务 准备写n个字节 返回这个事务实际能写的字节数
+// 每个数据块按两块预留 再加上inode 间接块和位图
+// 一次能写多少跟着日志区大小走 日志区大的话一个事务就能写很多
+static int begin_write(int n) {
+  int max = ((log_maxop() - 1 - 1 - 2) / 2) * BSIZE;
+
+  if (n > max) {
+    n = max;
+  }
+  begin_opn(((n + BSIZE - 1) / BSIZE) * 2 + 1 + 1 + 2);
+  return n;
+}
+
+// 从文件in的当前偏移往管道送最多n个字节
+// 拿着in的锁直接从缓存块拷贝进管道 管道满了先放掉锁再等
+static int sendpipe(struct file* in, struct pipe* pi, int n) {
+  struct inode* ip = in->ip;
+  struct buf* bp;
+  int tot, m, r, eof;
+
+  for (tot = 0;;) {
+    ilock(ip);
+    for (r = 0; tot < n && in->off < ip->size; in->off += r, tot += r) {
+      m = BSIZE - in->off % BSIZE;
+      if (m > n - tot) {
+        m = n - tot;
+      }
+      if (m > ip->size - in->off) {
+        m = ip->size - in->off;
+      }
+      bp = ibread(ip, in->off / BSIZE);
+      r = pipeput(pi, (char*)bp->data + in->off % BSIZE, m);
+      brelse(bp);
+      if (r < 0) {
+        iunlock(ip);
+        return tot > 0 ? tot : -1;
+      }
+      if (r < m) {
+        in->off += r;
+        tot += r;
+        break;
+      }
+    }
+    eof = in->off >= ip->size;
+    iunlock(ip);
+    if (tot == n || eof) {
+      return tot;
+    }
+    if (pipewait(pi) < 0) {
+      return tot > 0 ? tot : -1;
+    }
+  }
+}
+
+// 在内核里把文件in从当前偏移开始的n个字节送到out 移动两边的偏移
+// in必须是inode文件 out是管道时直接从缓存块拷贝进管道
+// 否则经过内核里的一页中转 不经过用户空间 返回送出的字节数
+int filesend(struct file* out, struct file* in, int n) {
+  char* page;
+  int tot, m, r, w;
+
+  if (in->type != FD_INODE || in->readable == 0 || out->writable == 0 ||
+      n < 0) {
+    return -1;
+  }
+  if (out->type == FD_PIPE) {
+    return sendpipe(in, out->pipe, n);
+  }
+  if (out->type == FD_DEVICE &&
+      (out->major < 0 || out->major >= NDEV || !devsw[out->major].write)) {
+    return -1;
+  }
+  if ((page = kalloc()) == 0) {
+    return -1;
+  }
+  for (tot = 0; tot < n; tot += w) {
+    m = n - tot;
+    if (m > PGSIZE) {
+      m = PGSIZE;
+    }
+    if (out->type == FD_INODE) {
+      m = begin_write(m);
+    }
+    ilock(in->ip);
+    if ((r = readi(in->ip, 0, (uint64)page, in->off, m)) > 0) {
+      in->off += r;
+    }
+    iunlock(in->ip);
+    if (r <= 0) {
+      if (out->type == FD_INODE) {
+        end_op();
+      }
+      break;
+    }
+    if (out->type == FD_INODE) {
+      ilock(out->ip);
+      if ((w = writei(out->ip, 0, (uint64)page, out->off, r)) > 0) {
+        out->off += w;
+      }
+      iunlock(out->ip);
+      end_op();
+    } else {
+      w = devsw[out->major].write(0, (uint64)page, r);
+    }
+    if (w != r) {
+      tot = w > 0 ? tot + w : (tot > 0 ? tot : -1);
+      break;
+    }
+  }
+  kfree(page);
+  return tot;
+}
+
 // 读文件到用户空间
 int fileread(struct file* f, uint64 addr, int n) {
-  int r = 0;
-  if (f->readable == 0) {
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, 0);
+}
+
+// 按iov读文件到用户空间的多个缓冲区 iov是内核里的数组
+// off为0时从文件的当前偏移读并移动偏移 否则从*off读 不动文件的偏移
+// 只有inode文件能指定偏移 返回读到的总字节数
+int filereadv(struct file* f, struct iovec* iov, int cnt, uint* off) {
+  int i, r, tot;
+
+  if (f->readable == 0 || (off != 0 && f->type != FD_INODE)) {
     return -1;
   }
-  if (f->type == FD_PIPE) {
-    r = piperead(f->pipe, addr, n);
-  } else if (f->type == FD_DEVICE) {
-    // 设备读
-    if (f->major < 0 || f->major >= NDEV || !devsw[f->major].read) {
-      return -1;
+  if (f->type == FD_INODE) {
+    // 所有段在一次加锁里读完
+    if (off == 0) {
+      off = &f->off;
     }
-    // 调用devsw的read函数
-    r = devsw[f->major].read(1, addr, n);
-  } else if (f->type == FD_INODE) {
-    // 文件读
+    tot = 0;
     ilock(f->ip);
-    if ((r = readi(f->ip, 1, addr, f->off, n)) > 0) {
-      f->off += r;
+    for (i = 0; i < cnt; i++) {
+      if ((r = readi(f->ip, 1, (uint64)iov[i].base, *off, iov[i].len)) < 0) {
+        tot = tot > 0 ? tot : -1;
+        break;
+      }
+      *off += r;
+      tot += r;
+      if (r < iov[i].len) {
+        break;
+      }
     }
     iunlock(f->ip);
-  } else {
-    panic("fileread");
+    return tot;
+  }
+
+  // 管道和设备读到数据就返回 不会为了填后面的段再睡眠
+  for (tot = 0, i = 0; i < cnt && tot == 0; i++) {
+    if (iov[i].len == 0) {
+      continue;
+    }
+    if (f->type == FD_PIPE) {
+      r = piperead(f->pipe, (uint64)iov[i].base, iov[i].len);
+    } else if (f->type == FD_DEVICE) {
+      // 设备读
+      if (f->major < 0 || f->major >= NDEV || !devsw[f->major].read) {
+        return -1;
+      }
+      // 调用devsw的read函数
+      r = devsw[f->major].read(1, (uint64)iov[i].base, iov[i].len);
+    } else {
+      panic("fileread");
+    }
+    if (r <= 0) {
+      return r;
+    }
+    tot = r;
   }
-  return r;
+  return tot;
 }
 
 int filewrite(struct file* f, uint64 addr, int n) {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1, 0);
+}
+
+// 按iov把多个段依次写到inode的*off处 写完移动*off
+// 一个事务能装下的段放进同一个事务 每个事务只锁一次inode
+static int inodewritev(struct inode* ip, struct iovec* iov, int cnt,
+                       uint* off) {
+  int n, i, done, tot, n1, m, k, r;
 
-  if (f->writable == 0) {
+  for (n = 0, i = 0; i < cnt; i++) {
+    n += iov[i].len;
+  }
+  // 负的长度转成uint以后很大 加起来就成了负数
+  if (n < 0) {
     return -1;
   }
-
-  if (f->type == FD_PIPE) {
-    ret = pipewrite(f->pipe, addr, n);
-  } else if (f->type == FD_DEVICE) {
-    if (f->major < 0 || f->major >= NDEV || !devsw[f->major].write) {
-      return -1;
-    }
-    ret = devsw[f->major].write(1, addr, n);
-  } else if (f->type == FD_INODE) {
-    // 预留一些块
-    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
-    int i = 0;
-    while (i < n) {
-      int n1 = n - i;
-      // 计算出写入的大小是n1
-      if (n1 > max) {
-        n1 = max;
+  // i是正在写的段 done是这一段已经写了多少
+  i = 0;
+  done = 0;
+  for (tot = 0; tot < n; tot += n1) {
+    // 计算出这个事务写入的大小是n1
+    n1 = begin_write(n - tot);
+    ilock(ip);
+    for (m = 0, r = 0; m < n1; m += k) {
+      while (done == iov[i].len) {
+        i++;
+        done = 0;
       }
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0) {
-        f->off += r;
+      k = iov[i].len - done;
+      if (k > n1 - m) {
+        k = n1 - m;
       }
-      iunlock(f->ip);
-      end_op();
-
-      if (r != n1) {
-        // 写入大小不匹配
+      if ((r = writei(ip, 1, (uint64)iov[i].base + done, *off, k)) > 0) {
+        *off += r;
+      }
+      if (r != k) {
         break;
       }
-      i += r;
+      done += k;
+    }
+    iunlock(ip);
+    end_op();
+
+    if (m != n1) {
+      // 写入大小不匹配
+      return -1;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+  }
+  return n;
+}
+
+// 按iov把用户空间的多个缓冲区写到文件 iov是内核里的数组
+// off的含义和filereadv一样 全部写完返回总字节数 否则返回-1
+int filewritev(struct file* f, struct iovec* iov, int cnt, uint* off) {
+  int i, r, tot;
+
+  if (f->writable == 0 || (off != 0 && f->type != FD_INODE)) {
+    return -1;
+  }
+  if (f->type == FD_INODE) {
+    return inodewritev(f->ip, iov, cnt, off != 0 ? off : &f->off);
   }
 
-  return ret;
+  for (tot = 0, i = 0; i < cnt; i++) {
+    if (f->type == FD_PIPE) {
+      r = pipewrite(f->pipe, (uint64)iov[i].base, iov[i].len);
+    } else if (f->type == FD_DEVICE) {
+      if (f->major < 0 || f->major >= NDEV || !devsw[f->major].write) {
+        return -1;
+      }
+      r = devsw[f->major].write(1, (uint64)iov[i].base, iov[i].len);
+    } else {
+      panic("filewrite");
+    }
+    if (r < 0) {
+      return tot > 0 ? tot : -1;
+    }
+    tot += r;
+    if (r < iov[i].len) {
+      break;
+    }
+  }
+  return tot;
 }
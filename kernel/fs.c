@@ -10,6 +10,7 @@
 #include "includes/proc.h"
 #include "includes/defs.h"
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 
 // 操作系统只挂载了一个磁盘 这里也只设置一个超级块
 struct superblock sb;
@@ -24,6 +25,11 @@ static void readsb(int dev, struct superblock *sb) {
   brelse(b);
 }
 
+static void bcountfree(int dev);
+static void imapload(int dev);
+static void dcinit(void);
+static void dcpurge(uint dev, uint dir);
+
 // 文件系统初始化
 // 需要在第一个进程启动的时候 初始化 因为用到了睡眠锁
 void fsinit(int dev) {
@@ -33,56 +39,161 @@ void fsinit(int dev) {
   }
 
   initlog(dev, &sb);
+  // 日志恢复之后位图才是对的
+  bcountfree(dev);
+  imapload(dev);
 }
 
 // 清空一个块 整个块写0
+// 块是刚分配的 原来的内容没用 不用从磁盘读
 static void bzero(int dev, int bno) {
   struct buf *bp;
 
   // 打开buf后 需要brelse
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  // 写块用log写
-  log_write(bp);
+  bp = bgetzero(dev, bno);
+  // 新分配的块按数据块写 有序模式下不进日志
+  // 用作间接块或者文件夹的时候 之后的修改还会用log_write记进日志
+  log_data(bp);
   brelse(bp);
 }
 
-// 分配一个block
-// 主要就是修改位图
-static uint balloc(uint dev) {
-  int b, bi, m;
+// 空闲块的内存状态 挂载时数一遍位图得到
+struct {
+  struct spinlock lock;
+  uint nfree;  // 空闲块数
+  uint rotor;  // 没有goal的时候从这里往后找 每次分配后挪到分配的块后面
+  uint mrotor;  // 间接块和区段块从这里往后找 不去占文件数据后面的块
+} fsfree;
+
+// 数一个位图块里前lim位有几个0
+static uint bcount(uchar *data, uint lim) {
+  uint64 *w = (uint64 *)data;
+  uint64 x;
+  uint i, n;
+
+  n = 0;
+  for (i = 0; i * 64 < lim; i++) {
+    x = ~w[i];
+    if (lim - i * 64 < 64) {
+      // 超出磁盘的位不算
+      x &= ((uint64)1 << (lim - i * 64)) - 1;
+    }
+    for (; x; x &= x - 1) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// 挂载时数空闲块
+static void bcountfree(int dev) {
   struct buf *bp;
+  uint b;
 
-  bp = 0;
-  // 说明内部循环 一次会处理一个位图块 一个位图块可以表示的块大小 1024*8
-  // 但是这里size小于BPB 说明一个块存的位图就够表示整个磁盘了
+  initlock(&fsfree.lock, "fsfree");
+  fsfree.nfree = 0;
+  fsfree.rotor = 0;
+  fsfree.mrotor = 0;
   for (b = 0; b < sb.size; b += BPB) {
-    // bp是拿到当前位图块
     bp = bread(dev, BBLOCK(b, sb));
-    // 遍历当前位图块
-    // b + bi是当前位表示的块号
-    for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
-      // 当前位的掩码
-      // 这里之前写成了除号 导致位图块的数据不对 unlink的时候会出错执行了itrunc
-      // 清除位图块的时候发现当前块是空的
-      m = 1 << (bi % 8);
-      if ((bp->data[bi / 8] & m) == 0) {
-        // 当前位是空的
-        bp->data[bi / 8] |= m;  // 标记已使用
+    fsfree.nfree += bcount(bp->data, min(BPB, sb.size - b));
+    brelse(bp);
+  }
+}
+
+// 在位图块里从第bi位开始找第一个0位 找不到或者超过了lim返回-1
+// 一次看64位 整个字都是1就跳过
+static int bscan(uchar *data, uint bi, uint lim) {
+  uint64 *w = (uint64 *)data;
+  uint64 x;
+  uint i, k;
+
+  for (i = bi / 64; i * 64 < lim; i++) {
+    x = w[i];
+    if (i == bi / 64) {
+      // 起点前面的位当成已用
+      x |= ((uint64)1 << (bi % 64)) - 1;
+    }
+    if (x == ~(uint64)0) {
+      continue;
+    }
+    for (k = 0; x & 1; k++) {
+      x >>= 1;
+    }
+    if (i * 64 + k >= lim) {
+      return -1;
+    }
+    return i * 64 + k;
+  }
+  return -1;
+}
+
+// 分配一个block 主要就是修改位图
+// 从goal开始往后找第一个空闲块 到了结尾再从头找到goal
+// goal为0的时候从*rotor接着找 不用每次都扫一遍开头用满了的部分
+// 分配后*rotor挪到分配的块后面
+static uint balloc(uint dev, uint goal, uint *rotor) {
+  struct buf *bp;
+  uint b, base, end;
+  int bi, pass;
+
+  acquire(&fsfree.lock);
+  if (fsfree.nfree == 0) {
+    release(&fsfree.lock);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  if (goal == 0 || goal >= sb.size) {
+    goal = *rotor;
+  }
+  release(&fsfree.lock);
+
+  b = goal;
+  end = sb.size;
+  for (pass = 0; pass < 2; pass++) {
+    // 一次处理一个位图块 base是这个位图块管理的第一个块号
+    for (; b < end; b = base + BPB) {
+      base = b - b % BPB;
+      bp = bread(dev, BBLOCK(b, sb));
+      bi = bscan(bp->data, b - base, min(BPB, end - base));
+      if (bi >= 0) {
+        bp->data[bi / 8] |= 1 << (bi % 8);  // 标记已使用
         // 修改位图块的block
         log_write(bp);
         brelse(bp);
+        b = base + bi;
+        acquire(&fsfree.lock);
+        fsfree.nfree--;
+        *rotor = b + 1;
+        release(&fsfree.lock);
         // 清空新块
-        bzero(dev, b + bi);
-        return b + bi;
+        bzero(dev, b);
+        return b;
       }
+      brelse(bp);
     }
-    brelse(bp);
+    b = 0;
+    end = goal;
   }
   printf("balloc: out of blocks\n");
   return 0;
 }
 
+// 给ip分配一个块 从inode的goal开始找
+// 这样同一个文件的块尽量挨在一起
+static uint iballoc(struct inode *ip) {
+  uint addr;
+
+  if ((addr = balloc(ip->dev, ip->goal, &fsfree.rotor)) != 0) {
+    ip->goal = addr + 1;
+  }
+  return addr;
+}
+
+// 给间接块和区段块分配一个块 从单独的mrotor往后找
+// 不用文件的goal 否则会插进文件数据中间 把本来连续的块隔开
+static uint mballoc(uint dev) { return balloc(dev, 0, &fsfree.mrotor); }
+
 // 清除块
 // 修改位图
 static void bfree(int dev, uint b) {
@@ -102,6 +213,33 @@ static void bfree(int dev, uint b) {
   bp->data[bi / 8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&fsfree.lock);
+  fsfree.nfree++;
+  release(&fsfree.lock);
+}
+
+// 释放从b开始连续的n个块 每个位图块只读写一次
+static void bfreen(int dev, uint b, uint n) {
+  struct buf *bp;
+  uint end, base, k;
+  int m;
+
+  for (end = b + n; b < end; b = base + BPB) {
+    base = b - b % BPB;
+    bp = bread(dev, BBLOCK(b, sb));
+    for (k = b - base; k < BPB && base + k < end; k++) {
+      m = 1 << (k % 8);
+      if ((bp->data[k / 8] & m) == 0) {
+        panic("freeing free block");
+      }
+      bp->data[k / 8] &= ~m;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+  acquire(&fsfree.lock);
+  fsfree.nfree += n;
+  release(&fsfree.lock);
 }
 
 /**
@@ -113,54 +251,247 @@ static void bfree(int dev, uint b) {
  * iput(ip)若后续不再操作该文件，将Inode放回队列
  */
 
+// 根据设备号和inode号算出哈希桶
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIBUCKET)
+
+// 一个物理页能放几个inode inode表以页为单位增长和回收
+#define IPP ((int)(PGSIZE / sizeof(struct inode)))
+
+// 内存inode表 引用数降到0的inode不马上作废 留在表里
+// 下次iget同一个inode直接命中 ilock也不用再读磁盘
 struct {
-  struct spinlock lock;
-  struct inode inode[NINODE];
+  struct spinlock lock;  // 保护哈希链表 LRU链表 ref和ninode
+  int ninode;            // 当前inode表的大小
+
+  // LRU链表头 head.next是最近放下的 head.prev是最久没用的
+  // 所有inode都在这个链表上
+  struct inode head;
+
+  struct inode *bucket[NIBUCKET];  // 用hnext串起来的单向链表
 } itable;
 
-// 初始化内存中的inode表
+// 初始化内存中的inode表 inode在用到的时候再分配
 void iinit() {
-  int i = 0;
   initlock(&itable.lock, "itable");
+  itable.head.prev = &itable.head;
+  itable.head.next = &itable.head;
+  itable.ninode = 0;
+  dcinit();
+
+  printf("memory inode table init:\t done!\n");
+}
+
+// 从哈希桶中摘掉inode 调用者持有itable.lock
+static void iunhash(struct inode *ip) {
+  struct inode **pp;
 
-  // 初始化所有的INODE项
-  for (i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  for (pp = &itable.bucket[IHASH(ip->dev, ip->inum)]; *pp != 0;
+       pp = &(*pp)->hnext) {
+    if (*pp == ip) {
+      *pp = ip->hnext;
+      ip->hnext = 0;
+      return;
+    }
   }
+  panic("iunhash");
+}
 
-  printf("memory inode table init:\t done!\n");
+// 把inode挂进它的(dev, inum)所在的桶 调用者持有itable.lock
+static void ihash(struct inode *ip) {
+  struct inode **bkt = &itable.bucket[IHASH(ip->dev, ip->inum)];
+
+  ip->hnext = *bkt;
+  *bkt = ip;
+}
+
+// 从LRU链表中摘掉inode 调用者持有itable.lock
+static void ilruremove(struct inode *ip) {
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// 把inode挂到LRU链表上 调用者持有itable.lock
+// 内容还有用的放在头部 没读进内容的放在尾部 iget先拿它们
+// 所以从尾部往前找 没读进内容的空闲inode总是排在读进了内容的前面
+static void ilruadd(struct inode *ip) {
+  if (ip->valid) {
+    ip->next = itable.head.next;
+    ip->prev = &itable.head;
+    itable.head.next->prev = ip;
+    itable.head.next = ip;
+  } else {
+    ip->prev = itable.head.prev;
+    ip->next = &itable.head;
+    itable.head.prev->next = ip;
+    itable.head.prev = ip;
+  }
+}
+
+// inode表按页增长和回收 做法和bio.c里buffer cache的bgrow breclaim一样
+// 一页切成IPP个inode 整页都没被引用时才能交还给kalloc
+
+// 拿一页新的空inode 设备号和inode号都是0 返回0说明没有内存了
+// kalloc缺页时会调ireclaim 所以要先放掉itable.lock再kalloc
+static int igrow(void) {
+  struct inode *page, *ip;
+
+  if ((page = (struct inode *)kalloc()) == 0) {
+    return 0;
+  }
+  memset(page, 0, PGSIZE);
+
+  acquire(&itable.lock);
+  if (itable.ninode >= NINODEMAX) {
+    // 别的进程已经扩到上限了
+    release(&itable.lock);
+    kfree(page);
+    return 1;
+  }
+  for (ip = page; ip < page + IPP; ip++) {
+    initsleeplock(&ip->lock, "inode");
+    ihash(ip);
+    ilruadd(ip);
+  }
+  itable.ninode += IPP;
+  release(&itable.lock);
+  return 1;
+}
+
+// kalloc在buffer cache也交不出页的时候调用
+// 找一页上面的inode都没被引用 扔掉它们读进来的内容 把这页交出去
+// inode表至少保留NINODE个 找不到这样的页返回0
+void *ireclaim(void) {
+  struct inode *ip, *page, *x;
+
+  acquire(&itable.lock);
+  // 从最久没用的开始找
+  for (ip = itable.head.prev;
+       ip != &itable.head && itable.ninode - IPP >= NINODE; ip = ip->prev) {
+    if (ip->ref != 0) {
+      continue;
+    }
+    page = (struct inode *)PGROUNDDOWN((uint64)ip);
+    for (x = page; x < page + IPP; x++) {
+      if (x->ref != 0) {
+        break;
+      }
+    }
+    if (x < page + IPP) {
+      continue;
+    }
+    // 整页都没被引用 从桶和LRU链表中摘掉
+    for (x = page; x < page + IPP; x++) {
+      iunhash(x);
+      ilruremove(x);
+    }
+    itable.ninode -= IPP;
+    release(&itable.lock);
+    return page;
+  }
+  release(&itable.lock);
+  return 0;
 }
 
 static struct inode *iget(uint dev, uint inum);
 
+// 内存里的inode位图 挂载时从磁盘读进来
+// 分配inode的时候在这里找空位 不用把inode区一块一块读一遍
+struct {
+  struct spinlock lock;
+  uchar *map;  // 一位表示一个inode 1是已分配
+  uint next;   // 从这里往后找空闲inode 它前面的都分配出去了
+} imap;
+
+// 挂载时读入inode位图
+static void imapload(int dev) {
+  struct buf *bp;
+  uint k, nb;
+
+  initlock(&imap.lock, "imap");
+  nb = sb.ninodes / BPB + 1;
+  if (nb * BSIZE > PGSIZE) {
+    panic("imapload: too many inodes");
+  }
+  if ((imap.map = kalloc()) == 0) {
+    panic("imapload: kalloc");
+  }
+  memset(imap.map, 0, PGSIZE);
+  for (k = 0; k < nb; k++) {
+    bp = bread(dev, sb.imapstart + k);
+    memmove(imap.map + k * BSIZE, bp->data, BSIZE);
+    brelse(bp);
+  }
+  imap.next = 1;
+}
+
+// 修改磁盘上inode位图里inum那一位
+// 和inode本身的修改在同一个事务里
+static void imapwrite(uint dev, uint inum, int used) {
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, sb.imapstart + inum / BPB);
+  bi = inum % BPB;
+  m = 1 << (bi % 8);
+  if (used) {
+    bp->data[bi / 8] |= m;
+  } else {
+    bp->data[bi / 8] &= ~m;
+  }
+  log_write(bp);
+  brelse(bp);
+}
+
 // 分配一个inode
+// 空闲的inode从内存位图里找 只读写要分配的那个inode所在的块
 struct inode *ialloc(uint dev, short type) {
   int inum;
   struct buf *bp;
   struct dinode *dip;
 
-  // 遍历inodes区
-  for (inum = 1; inum < sb.ninodes; inum++) {
-    // 拿到inode存放在哪个块上
-    bp = bread(dev, IBLOCK(inum, sb));
-    // 拿到磁盘上的inode结构
-    dip = (struct dinode *)bp->data + inum % IPB;
-    if (dip->type == 0) {
-      // 空的inode
-      // inode结构体写0
-      memset(dip, 0, sizeof(*dip));
-      // 设置类型
-      dip->type = type;
-      // 写到磁盘 标记当前inode被分配了
-      log_write(bp);
-      brelse(bp);
-      // 返回inode结构体
-      return iget(dev, inum);
-    }
-    brelse(bp);
+  acquire(&imap.lock);
+  inum = bscan(imap.map, imap.next, sb.ninodes);
+  if (inum < 0) {
+    release(&imap.lock);
+    printf("ialloc: no inodes\n");
+    return 0;
   }
-  printf("ialloc: no inodes\n");
-  return 0;
+  // 先在内存里占上 别的进程就不会再选到它
+  imap.map[inum / 8] |= 1 << (inum % 8);
+  imap.next = inum + 1;
+  release(&imap.lock);
+
+  imapwrite(dev, inum, 1);
+  // 拿到inode存放在哪个块上
+  bp = bread(dev, IBLOCK(inum, sb));
+  // 拿到磁盘上的inode结构
+  dip = (struct dinode *)bp->data + inum % IPB;
+  if (dip->type != 0) {
+    panic("ialloc: inode in use");
+  }
+  // inode结构体写0
+  memset(dip, 0, sizeof(*dip));
+  // 设置类型 普通文件按区段映射
+  dip->type = type;
+  if (type == T_FILE) {
+    dip->flags = I_EXTENT;
+  }
+  // 写到磁盘 标记当前inode被分配了
+  log_write(bp);
+  brelse(bp);
+  // 返回inode结构体
+  return iget(dev, inum);
+}
+
+// 释放inode号 调用者已经把inode的type清零了
+static void ifreeinum(uint dev, uint inum) {
+  imapwrite(dev, inum, 0);
+  acquire(&imap.lock);
+  imap.map[inum / 8] &= ~(1 << (inum % 8));
+  if (inum < imap.next) {
+    imap.next = inum;
+  }
+  release(&imap.lock);
 }
 
 // 内存中的inode信息被修改后 同步到磁盘
@@ -172,6 +503,7 @@ void iupdate(struct inode *ip) {
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode *)bp->data + ip->inum % IPB;
   dip->type = ip->type;
+  dip->flags = ip->flags;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
@@ -186,37 +518,57 @@ void iupdate(struct inode *ip) {
 // 根据设备号和inode号寻找缓存 没有则从table中找到一个可用项并设置其信息
 // iget不从硬盘读取该inode数据 不申请该项睡眠锁。
 static struct inode *iget(uint dev, uint inum) {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int nomem = 0;
 
   acquire(&itable.lock);
-  empty = 0;
+  while (1) {
+    // 查看inode在不在内存的inode表中 没被引用的也算
+    for (ip = itable.bucket[IHASH(dev, inum)]; ip != 0; ip = ip->hnext) {
+      if (ip->dev == dev && ip->inum == inum) {
+        ip->ref++;
+        release(&itable.lock);
+        return ip;
+      }
+    }
 
-  // 查看inode在不在内存的inode表中
-  for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-      ip->ref++;
+    // 从LRU链表尾部倒着找没被引用的inode
+    // 见ilruadd 先找到的是没读进内容的 找到读进了内容的说明已经没有空的了
+    for (ip = itable.head.prev; ip != &itable.head; ip = ip->prev) {
+      if (ip->ref != 0) {
+        continue;
+      }
+      if (ip->valid && itable.ninode < NINODEMAX && !nomem) {
+        // 还没到上限就先扩大inode表 不替换读进来的inode
+        break;
+      }
+      // 设置空闲inode 并设置valid为0 表示未被读进
+      iunhash(ip);
+      ip->dev = dev;
+      ip->inum = inum;
+      ihash(ip);
+      ip->ref = 1;
+      ip->valid = 0;
+      ip->ranext = 0;
+      ip->rawin = 0;
+      ip->raend = 0;
+      ip->mapn = 0;
+      ip->extlen = 0;
+      ip->goal = 0;
+      ip->dirfree = 0;
       release(&itable.lock);
       return ip;
     }
-    if (empty == 0 && ip->ref == 0) {
-      // 从inodes表中找一个空槽
-      empty = ip;
-    }
-  }
 
-  if (empty == 0) {
+    if (itable.ninode < NINODEMAX && !nomem) {
+      // 新的inode在LRU尾部 扩大之后重新找一遍
+      release(&itable.lock);
+      nomem = !igrow();
+      acquire(&itable.lock);
+      continue;
+    }
     panic("iget: no inodes");
   }
-
-  // 设置空闲inode 并设置valid为0 表示未被读进
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&itable.lock);
-
-  return ip;
 }
 
 // 增加引用数量
@@ -246,6 +598,7 @@ void ilock(struct inode *ip) {
     dip = (struct dinode *)bp->data + ip->inum % IPB;
     // 拷贝到内存inode
     ip->type = dip->type;
+    ip->flags = dip->flags;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
@@ -283,9 +636,14 @@ void iput(struct inode *ip) {
 
     release(&itable.lock);
 
+    // 目录的inode号会被重新分配 它名下的缓存项要一起扔掉
+    if (ip->type == T_DIR) {
+      dcpurge(ip->dev, ip->inum);
+    }
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    ifreeinum(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -293,6 +651,11 @@ void iput(struct inode *ip) {
     acquire(&itable.lock);
   }
   ip->ref--;
+  if (ip->ref == 0) {
+    // 读进来的内容留着 下次iget还能用 刚释放掉的inode放到尾部先被重用
+    ilruremove(ip);
+    ilruadd(ip);
+  }
 
   release(&itable.lock);
 }
@@ -303,17 +666,186 @@ void iunlockput(struct inode *ip) {
   iput(ip);
 }
 
+// 在一棵level级的间接映射树里找第bn块 *root是树根的块号
+// 缺的映射块和数据块都会分配 fbn是这一块在文件里的块号 用来缓存映射
+// bn超出这棵树的范围或者分配失败返回0
+static uint iwalk(struct inode *ip, uint *root, uint bn, int level,
+                  uint fbn) {
+  uint addr, span, base, i, *a;
+  struct buf *bp;
+
+  for (span = 1, i = 0; i < level; i++) {
+    span *= NINDIRECT;
+  }
+  if (bn >= span) {
+    return 0;
+  }
+  // 寻找根映射块 如果没有 分配一个
+  if ((addr = *root) == 0) {
+    addr = mballoc(ip->dev);
+    if (addr == 0) return 0;
+    *root = addr;
+  }
+  // 一级一级往下走 每一项管理span / NINDIRECT个块
+  for (; level > 0; level--) {
+    span /= NINDIRECT;
+    // 读间接映射块 a应当是一个uint[]
+    bp = bread(ip->dev, addr);
+    a = (uint *)bp->data;
+    i = bn / span;
+    bn %= span;
+    // 如果为0的话 分配下一级的映射块或者数据块
+    // 同时因为修改了间接映射快 重写简介映射块
+    if ((addr = a[i]) == 0) {
+      addr = level > 1 ? mballoc(ip->dev) : iballoc(ip);
+      if (addr) {
+        a[i] = addr;
+        log_write(bp);
+      }
+    }
+    // 最底层的间接块 把i所在的一段映射拷进缓存
+    if (level == 1) {
+      base = i - i % NMAPCACHE;
+      memmove(ip->map, a + base, sizeof(ip->map));
+      ip->mapbn = fbn - (i - base);
+      ip->mapn = NMAPCACHE;
+    }
+    brelse(bp);
+    if (addr == 0) {
+      return 0;
+    }
+  }
+  return addr;
+}
+
+// 按区段映射的inode的bmap
+// 文件没有空洞 没映射的块只能是紧接着最后一个区段的那个块
+// 分配的时候优先让最后一个区段变长
+// 区段都用完了以后 后面的块退回按块映射 放在区段块的ETAIL项指向的树里
+static uint emap(struct inode *ip, uint bn) {
+  struct extent *e, *last;
+  struct buf *bp;
+  uint pos, addr, root;
+  int i, n, lastinbp;
+
+  // 顺序访问的时候大多落在上次命中的区段里
+  if (bn - ip->extbn < ip->extlen) {
+    return ip->extaddr + (bn - ip->extbn);
+  }
+  // 按块映射的部分也缓存了最近查过的一段
+  if (ip->mapn > 0 && bn - ip->mapbn < ip->mapn &&
+      (addr = ip->map[bn - ip->mapbn]) != 0) {
+    return addr;
+  }
+
+  // 先找inode里的区段 用满了再找区段块里的
+  bp = 0;
+  last = 0;
+  lastinbp = 0;
+  pos = 0;
+  e = (struct extent *)ip->addrs;
+  n = NIEXT;
+  for (i = 0;; i++) {
+    if (i == n) {
+      if (bp != 0 || ip->addrs[EXTBLK] == 0) {
+        break;
+      }
+      bp = bread(ip->dev, ip->addrs[EXTBLK]);
+      e = (struct extent *)bp->data;
+      n = NEXTPB;
+      i = 0;
+    }
+    if (e[i].len == 0) {
+      break;
+    }
+    if (bn - pos < e[i].len) {
+      ip->extbn = pos;
+      ip->extaddr = e[i].start;
+      ip->extlen = e[i].len;
+      addr = e[i].start + (bn - pos);
+      if (bp) {
+        brelse(bp);
+      }
+      return addr;
+    }
+    pos += e[i].len;
+    last = &e[i];
+    lastinbp = bp != 0;
+  }
+  if (bp != 0 && i == n) {
+    // 区段块也满了 剩下的块按块映射 碎片很多的文件也能一直写到最大
+    root = e[ETAIL].start;
+    addr = iwalk(ip, &e[ETAIL].start, bn - pos, NLEVEL - 1, bn);
+    if (e[ETAIL].start != root) {
+      log_write(bp);
+    }
+    goto out;
+  }
+  if (bn != pos) {
+    panic("emap: hole");
+  }
+
+  // 先找紧接着最后一个区段的块 找到的话区段直接变长
+  if (last) {
+    ip->goal = last->start + last->len;
+  }
+  if ((addr = iballoc(ip)) == 0) {
+    goto out;
+  }
+  if (last && addr == last->start + last->len) {
+    last->len++;
+    if (lastinbp) {
+      log_write(bp);
+    }
+    ip->extbn = pos + 1 - last->len;
+    ip->extaddr = last->start;
+    ip->extlen = last->len;
+  } else {
+    // 新开一个区段
+    if (i == n && bp == 0) {
+      // inode里的区段满了 还没有区段块 分配一个
+      if ((ip->addrs[EXTBLK] = mballoc(ip->dev)) == 0) {
+        bfree(ip->dev, addr);
+        addr = 0;
+        goto out;
+      }
+      bp = bread(ip->dev, ip->addrs[EXTBLK]);
+      e = (struct extent *)bp->data;
+      n = NEXTPB;
+      i = 0;
+    }
+    e[i].start = addr;
+    e[i].len = 1;
+    if (bp) {
+      log_write(bp);
+    }
+    ip->extbn = pos;
+    ip->extaddr = addr;
+    ip->extlen = 1;
+  }
+out:
+  if (bp) {
+    brelse(bp);
+  }
+  return addr;
+}
+
 // 读取inode中记录的映射的地址
 // 传入的bn是block number
+// 不够的间接映射块和数据块都会分配 调用者持有inode的锁
 static uint bmap(struct inode *ip, uint bn) {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, span, fbn;
+  int level;
+
+  if (ip->flags & I_EXTENT) {
+    return emap(ip, bn);
+  }
 
   // 如果block number是直接映射
   if (bn < NDIRECT) {
     if ((addr = ip->addrs[bn]) == 0) {
       // 如果这个块是空的 分配一下
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if (addr == 0) {
         return 0;
       }
@@ -321,41 +853,88 @@ static uint bmap(struct inode *ip, uint bn) {
     }
     return addr;
   }
+  // 顺序访问时 大概率落在上次查过的那段映射里 不用再读间接块
+  if (ip->mapn > 0 && bn - ip->mapbn < ip->mapn &&
+      (addr = ip->map[bn - ip->mapbn]) != 0) {
+    return addr;
+  }
   // 如果走到这里 说明是间接映射
+  fbn = bn;
   bn -= NDIRECT;
 
-  if (bn < NINDIRECT) {
-    // 寻找间接映射块 如果没间接映射块 分配一个
-    if ((addr = ip->addrs[NDIRECT]) == 0) {
-      addr = balloc(ip->dev);
-      if (addr == 0) return 0;
-      ip->addrs[NDIRECT] = addr;
+  // 找出是几级间接映射 span是这一级总共能管理的块数
+  span = NINDIRECT;
+  for (level = 1; bn >= span; level++) {
+    if (level == NLEVEL) {
+      panic("bmap: out of range");
     }
-    // 读间接映射块
-    bp = bread(ip->dev, addr);
+    bn -= span;
+    span *= NINDIRECT;
+  }
+
+  return iwalk(ip, &ip->addrs[NDIRECT + level - 1], bn, level, fbn);
+}
+
+// 释放一个level级的间接映射块 和它下面所有的块
+static void ifree(uint dev, uint addr, int level) {
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  if (level > 0) {
+    // 读入间接映射块 先释放它指向的下一级
+    bp = bread(dev, addr);
     a = (uint *)bp->data;
-    // a应当是一个uint[]
-    // 如果为0的话 分配数据块
-    // 同时因为修改了间接映射快 重写简介映射块
-    if ((addr = a[bn]) == 0) {
-      addr = balloc(ip->dev);
-      if (addr) {
-        a[bn] = addr;
-        log_write(bp);
+    for (j = 0; j < NINDIRECT; j++) {
+      if (a[j]) {
+        ifree(dev, a[j], level - 1);
       }
     }
     brelse(bp);
-    return addr;
   }
-  panic("bmap: out of range");
+  bfree(dev, addr);
+}
+
+// 释放区段里的所有块 整段一起清位图
+static void efree(uint dev, struct extent *e) { bfreen(dev, e->start, e->len); }
+
+// 释放按区段映射的inode的所有块
+static void etrunc(struct inode *ip) {
+  struct extent *e = (struct extent *)ip->addrs;
+  struct buf *bp;
+  int i;
+
+  for (i = 0; i < NIEXT && e[i].len > 0; i++) {
+    efree(ip->dev, &e[i]);
+  }
+  if (ip->addrs[EXTBLK]) {
+    bp = bread(ip->dev, ip->addrs[EXTBLK]);
+    e = (struct extent *)bp->data;
+    for (i = 0; i < NEXTPB && e[i].len > 0; i++) {
+      efree(ip->dev, &e[i]);
+    }
+    if (e[ETAIL].start) {
+      ifree(ip->dev, e[ETAIL].start, NLEVEL - 1);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[EXTBLK]);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->extlen = 0;
+  ip->mapn = 0;
 }
 
 // 清除inode 和内容
 // 调用者需要有inode的锁
 void itrunc(struct inode *ip) {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if (ip->flags & I_EXTENT) {
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   // 清除直接映射的内容
   for (i = 0; i < NDIRECT; i++) {
@@ -366,22 +945,14 @@ void itrunc(struct inode *ip) {
     }
   }
 
-  // 间接映射
-  if (ip->addrs[NDIRECT]) {
-    // 读入间接映射块
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint *)bp->data;
-    for (j = 0; j < NINDIRECT; j++) {
-      if (a[j]) {
-        // 清理间接映射的数据块
-        bfree(ip->dev, a[j]);
-      }
+  // 各级间接映射
+  for (i = 1; i <= NLEVEL; i++) {
+    if (ip->addrs[NDIRECT + i - 1]) {
+      ifree(ip->dev, ip->addrs[NDIRECT + i - 1], i);
+      ip->addrs[NDIRECT + i - 1] = 0;
     }
-    brelse(bp);
-    // 释放间接映射块
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->mapn = 0;
 
   ip->size = 0;
   // 更新硬盘中的inode
@@ -397,10 +968,68 @@ void stati(struct inode *ip, struct stat *st) {
   st->size = ip->size;
 }
 
+// 读文件的第bn块 返回缓存里加了锁的buf 调用者用完brelse
+// 调用者持有inode的锁 bn在文件大小之内
+struct buf *ibread(struct inode *ip, uint bn) {
+  uint addr;
+
+  if ((addr = bmap(ip, bn)) == 0) {
+    panic("ibread");
+  }
+  return bread(ip->dev, addr);
+}
+
 // 从inode读文件
 // 调用者必须由inode的锁 如果user_dst为1 说明dst是user vm
 // 其他情况dst是kernel vm
 // inode dst标志位 dst 偏移 大小
+// 读之前先把要用到的块和预读窗口里的块一起异步读进缓存
+// 磁盘上连续的块合成一个请求 之后readi里的bread等在buf的锁上
+// 从上次读结束的块接着读就算顺序读 窗口翻倍 否则窗口清零
+// 调用者持有inode的锁
+static void readahead(struct inode *ip, uint off, uint n) {
+  uint bn = off / BSIZE;
+  uint last = (off + n - 1) / BSIZE;
+  uint nblk = (ip->size + BSIZE - 1) / BSIZE;
+  uint end, addr, start, len;
+
+  if (bn == ip->ranext) {
+    ip->rawin = ip->rawin == 0 ? RAMIN : min(ip->rawin * 2, RAMAX);
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  // 下一次从这次读的结尾所在的块开始 就还是顺序读
+  ip->ranext = (off + n) / BSIZE;
+
+  // 预读过的块还剩一半以上就先不读 攒成一大段再一起提交
+  if (ip->raend > last && ip->raend - last - 1 > ip->rawin / 2) {
+    return;
+  }
+  end = min(last + 1 + ip->rawin, nblk);
+  start = len = 0;
+  for (bn = max(bn, ip->raend); bn < end; bn++) {
+    if ((addr = bmap(ip, bn)) == 0) {
+      break;
+    }
+    // 接不上前面那一段 或者攒满了 先把前面的提交
+    if (len > 0 && (addr != start + len || len == NCLUSTER)) {
+      breadahead(ip->dev, start, len);
+      len = 0;
+    }
+    if (len == 0) {
+      start = addr;
+    }
+    len++;
+  }
+  if (len > 0) {
+    breadahead(ip->dev, start, len);
+  }
+  if (end > ip->raend) {
+    ip->raend = end;
+  }
+}
+
 int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
   uint tot, m;
   struct buf *bp;
@@ -414,6 +1043,9 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
     // 从偏移量开始读到结尾
     n = ip->size - off;
   }
+  if (n > 0) {
+    readahead(ip, off, n);
+  }
   // tot 是读取的字节 n是读取的总大小 m是循环执行时读取的大小
   // 这里的m需要在循环里计算 因为有off和n的缘故 一般不会是页大小
   for (tot = 0; tot < n; tot += m, off += m, dst += m) {
@@ -450,8 +1082,8 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
   if (off > ip->size || off + n < off) {
     return -1;
   }
-  // 超过单文件最大
-  if (off + n > MAXFILE * BSIZE) {
+  // 超过单文件最大 MAXFILE * BSIZE超过了uint 按uint64比较
+  if ((uint64)off + n > (uint64)MAXFILE * BSIZE) {
     return -1;
   }
   // 和readi差不多
@@ -471,7 +1103,12 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    // 文件夹的内容是元数据 必须进日志
+    if (ip->type == T_DIR) {
+      log_write(bp);
+    } else {
+      log_data(bp);
+    }
     brelse(bp);
   }
 
@@ -490,44 +1127,373 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
 // 比较文件名
 int namecmp(const char *s, const char *t) { return strncmp(s, t, DIRSIZ); }
 
-// 给文件名 查找类型为文件夹的inode下的文件 返回文件描述符
-struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
-  uint off, inum;
-  struct dirent de;
+// 目录项缓存 记住目录dir里名字name对应的inode号
+// inum为0的是否定项 说明目录里没有这个名字
+// 某个目录名下的项只在持有这个目录inode锁的时候修改
+// 所以和目录的内容总是一致的 dcache.lock只保护链表
+// 路径解析可以不拿锁直接读哈希链 用seq判断读的时候缓存有没有被改过
+struct dentry {
+  uint dev;
+  uint dir;  // 所在目录的inode号 0表示空闲
+  char name[DIRSIZ];
+  uint inum;
+  int hot;  // 不拿锁的路径解析用过 替换的时候再给一次机会
+  struct dentry *prev;  // LRU链表
+  struct dentry *next;
+  struct dentry *hnext;  // 哈希桶链表
+};
 
-  if (dp->type != T_DIR) {
-    panic("dirlookup not DIR");
+struct {
+  struct spinlock lock;
+  // 修改哈希链和项的内容前后各加一 是奇数说明正在修改
+  uint seq;
+  struct dentry entry[NDCACHE];
+  // LRU链表 head.next是最近用过的
+  struct dentry head;
+  struct dentry *bucket[NDBUCKET];
+} dcache;
+
+static void dcinit(void) {
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for (d = dcache.entry; d < dcache.entry + NDCACHE; d++) {
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
   }
+}
 
-  // 遍历文件夹的文件项
-  for (off = 0; off < dp->size; off += sizeof(de)) {
-    // 读一个文件项到de
-    if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
-      panic("dirlookup read");
+static uint dchash(uint dev, uint dir, char *name) {
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for (i = 0; i < DIRSIZ && name[i] != 0; i++) {
+    h = h * 31 + (uchar)name[i];
+  }
+  return h % NDBUCKET;
+}
+
+// 在哈希桶里找 调用者持有dcache.lock
+static struct dentry *dcfind(uint dev, uint dir, char *name) {
+  struct dentry *d;
+
+  for (d = dcache.bucket[dchash(dev, dir, name)]; d != 0; d = d->hnext) {
+    if (d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0) {
+      return d;
     }
-    // 当前文件项无效
-    if (de.inum == 0) {
-      continue;
+  }
+  return 0;
+}
+
+// 从哈希桶中摘掉并标记为空闲 调用者持有dcache.lock
+static void dcunhash(struct dentry *d) {
+  struct dentry **pp;
+
+  for (pp = &dcache.bucket[dchash(d->dev, d->dir, d->name)]; *pp != 0;
+       pp = &(*pp)->hnext) {
+    if (*pp == d) {
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->hnext = 0;
+  d->dir = 0;
+}
+
+// 开始和结束修改哈希链 调用者持有dcache.lock
+static void dcbegin(void) {
+  dcache.seq++;
+  __sync_synchronize();
+}
+
+static void dcend(void) {
+  __sync_synchronize();
+  dcache.seq++;
+}
+
+// 挪到LRU链表的头部或者尾部 调用者持有dcache.lock
+static void dcmove(struct dentry *d, int front) {
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if (front) {
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+  } else {
+    d->next = &dcache.head;
+    d->prev = dcache.head.prev;
+  }
+  d->next->prev = d;
+  d->prev->next = d;
+}
+
+// 查缓存 命中返回1 inum写入*pinum 为0说明名字不存在
+// 调用者持有目录dp的锁
+static int dclookup(struct inode *dp, char *name, uint *pinum) {
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if ((d = dcfind(dp->dev, dp->inum, name)) == 0) {
+    release(&dcache.lock);
+    return 0;
+  }
+  *pinum = d->inum;
+  dcmove(d, 1);
+  release(&dcache.lock);
+  return 1;
+}
+
+// 记下目录dp里name对应inum inum为0记一个否定项
+// 没有空闲项时替换最久没用的 调用者持有目录dp的锁
+static void dcinsert(struct inode *dp, char *name, uint inum) {
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if ((d = dcfind(dp->dev, dp->inum, name)) == 0) {
+    while ((d = dcache.head.prev)->hot) {
+      d->hot = 0;
+      dcmove(d, 1);
+    }
+    dcbegin();
+    if (d->dir != 0) {
+      dcunhash(d);
+    }
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->inum = inum;
+    h = dchash(d->dev, d->dir, d->name);
+    d->hnext = dcache.bucket[h];
+    dcache.bucket[h] = d;
+    dcend();
+  } else if (d->inum != inum) {
+    dcbegin();
+    d->inum = inum;
+    dcend();
+  }
+  dcmove(d, 1);
+  release(&dcache.lock);
+}
+
+// 目录dp里的name被删掉了 去掉对应的缓存项
+// 调用者持有目录dp的锁
+static void dcinval(struct inode *dp, char *name) {
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if ((d = dcfind(dp->dev, dp->inum, name)) != 0) {
+    dcbegin();
+    dcunhash(d);
+    dcend();
+    dcmove(d, 0);
+  }
+  release(&dcache.lock);
+}
+
+// 目录被释放了 去掉它名下所有的缓存项
+static void dcpurge(uint dev, uint dir) {
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for (d = dcache.entry; d < dcache.entry + NDCACHE; d++) {
+    if (d->dev == dev && d->dir == dir) {
+      dcbegin();
+      dcunhash(d);
+      dcend();
+      dcmove(d, 0);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// 按块遍历目录[off, end) 每个块只bread一次 在buf里直接比较
+// name不为0时找名字是name的项 把inode号写入*pinum
+// name为0时找空闲项
+// 返回找到的项在目录里的偏移 找不到返回-1
+static int dirscan(struct inode *dp, uint off, uint end, char *name,
+                   uint *pinum) {
+  struct buf *bp;
+  struct dirent *de, *e;
+  uint addr;
+
+  end = min(end, dp->size);
+  while (off < end) {
+    if ((addr = bmap(dp, off / BSIZE)) == 0) {
+      panic("dirscan");
     }
-    // 对比一下文件名
-    if (namecmp(name, de.name) == 0) {
-      if (poff) {
-        // 修改poff为文件夹类型inode中文件夹项的偏移地址
-        *poff = off;
+    bp = bread(dp->dev, addr);
+    de = (struct dirent *)(bp->data + off % BSIZE);
+    e = de + min(end - off, BSIZE - off % BSIZE) / sizeof(*de);
+    for (; de < e; de++, off += sizeof(*de)) {
+      if (name == 0 ? de->inum == 0
+                    : de->inum != 0 && namecmp(name, de->name) == 0) {
+        if (pinum) {
+          *pinum = de->inum;
+        }
+        brelse(bp);
+        return off;
       }
-      // 读到了inode号
-      inum = de.inum;
-      // 分配一个inode内存节点
-      return iget(dp->dev, inum);
     }
+    brelse(bp);
+  }
+  return -1;
+}
+
+// 哈希索引的文件夹里 名字name只可能在返回的这个块里
+static uint htleaf(struct inode *dp, char *name) {
+  struct buf *bp;
+  uint bn, depth;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  depth = HTENT(bp->data, 0);
+  bn = HTENT(bp->data, 1 + (dirhash(name) & ((1 << depth) - 1)));
+  brelse(bp);
+  return bn;
+}
+
+// 文件夹唯一的块满了 改成哈希索引的格式
+// 第0块除了.和..之外的项原样挪到第1块 第0块改写成depth为0的索引
+// 先复制出第1块 磁盘满了分配不到就什么都不改 返回-1
+static int htconvert(struct inode *dp) {
+  struct buf *bp;
+  struct dirent de;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  if (writei(dp, 0, (uint64)bp->data, BSIZE, BSIZE) != BSIZE) {
+    brelse(bp);
+    return -1;
+  }
+  memset(bp->data + 2 * sizeof(de), 0, BSIZE - 2 * sizeof(de));
+  HTENT(bp->data, 0) = 0;
+  HTENT(bp->data, 1) = 1;
+  log_write(bp);
+  brelse(bp);
+
+  // 挪过去的.和..清掉
+  memset(&de, 0, sizeof(de));
+  writei(dp, 0, (uint64)&de, BSIZE, sizeof(de));
+  writei(dp, 0, (uint64)&de, BSIZE + sizeof(de), sizeof(de));
+
+  dp->flags |= I_HTREE;
+  iupdate(dp);
+  return 0;
+}
+
+// 哈希索引文件夹的第bn块满了 按哈希值的下一位分到新加的块里
+// 索引用的位数不够就先把索引翻倍 不能再翻倍了返回-1
+// 先分配好新块再改索引和旧块 磁盘满了返回-1 文件夹保持原样
+static int htsplit(struct inode *dp, uint bn) {
+  struct buf *bp, *old, *new;
+  struct dirent *de;
+  uint depth, ld, nb, i, n;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  depth = HTENT(bp->data, 0);
+  // 有2^(depth-ld)个索引指向这个块 ld是它实际用了哈希值的几位
+  for (n = 0, i = 0; i < (1 << depth); i++) {
+    if (HTENT(bp->data, 1 + i) == bn) {
+      n++;
+    }
+  }
+  for (ld = depth; n > 1; n >>= 1) {
+    ld--;
+  }
+  nb = dp->size / BSIZE;
+  if ((ld == depth && depth == HTMAXDEPTH) || nb > 0xffff) {
+    brelse(bp);
+    return -1;
   }
 
+  // 先把整块复制成新块 再在两边各清掉不属于自己的项
+  old = bread(dp->dev, bmap(dp, bn));
+  if (writei(dp, 0, (uint64)old->data, nb * BSIZE, BSIZE) != BSIZE) {
+    brelse(old);
+    brelse(bp);
+    return -1;
+  }
+  if (ld == depth) {
+    for (i = 0; i < (1 << depth); i++) {
+      HTENT(bp->data, 1 + (1 << depth) + i) = HTENT(bp->data, 1 + i);
+    }
+    depth++;
+    HTENT(bp->data, 0) = depth;
+  }
+  new = bread(dp->dev, bmap(dp, nb));
+  for (i = 0; i < BSIZE / sizeof(*de); i++) {
+    de = (struct dirent *)old->data + i;
+    if (de->inum == 0) {
+      continue;
+    }
+    if (dirhash(de->name) >> ld & 1) {
+      memset(de, 0, sizeof(*de));
+    } else {
+      memset((struct dirent *)new->data + i, 0, sizeof(*de));
+    }
+  }
+  log_write(old);
+  log_write(new);
+  brelse(new);
+  brelse(old);
+
+  for (i = 0; i < (1 << depth); i++) {
+    if (HTENT(bp->data, 1 + i) == bn && (i >> ld & 1)) {
+      HTENT(bp->data, 1 + i) = nb;
+    }
+  }
+  log_write(bp);
+  brelse(bp);
   return 0;
 }
 
+// 给文件名 查找类型为文件夹的inode下的文件 返回文件描述符
+// 不需要偏移的时候先查目录项缓存 查不到再读目录 结果不管有没有都记下来
+struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
+  uint inum, bn;
+  int off;
+
+  if (dp->type != T_DIR) {
+    panic("dirlookup not DIR");
+  }
+
+  if (poff == 0 && dclookup(dp, name, &inum)) {
+    return inum != 0 ? iget(dp->dev, inum) : 0;
+  }
+  if (dp->flags & I_HTREE) {
+    // .和..留在第0块的开头 不在索引里
+    // 其他名字只用读索引和一个块
+    if (namecmp(name, ".") == 0 || namecmp(name, "..") == 0) {
+      off = dirscan(dp, 0, 2 * sizeof(struct dirent), name, &inum);
+    } else {
+      bn = htleaf(dp, name);
+      off = dirscan(dp, bn * BSIZE, (bn + 1) * BSIZE, name, &inum);
+    }
+  } else {
+    off = dirscan(dp, 0, dp->size, name, &inum);
+  }
+  if (off < 0) {
+    dcinsert(dp, name, 0);
+    return 0;
+  }
+  dcinsert(dp, name, inum);
+  if (poff) {
+    // 修改poff为文件夹类型inode中文件夹项的偏移地址
+    *poff = off;
+  }
+  // 分配一个inode内存节点
+  return iget(dp->dev, inum);
+}
+
 // 给一个类型为文件夹的inode中写入一个新的文件夹项
+// 哈希索引的文件夹满了 或者磁盘满了返回-1
+// 调用者要用begin_opn(DIROPBLOCKS)开始事务 分裂最多NHTSPLIT次
 int dirlink(struct inode *dp, char *name, uint inum) {
-  int off;
+  int off, n;
+  uint bn;
   struct dirent de;
   struct inode *ip;
 
@@ -537,22 +1503,92 @@ int dirlink(struct inode *dp, char *name, uint inum) {
     return -1;
   }
 
-  // 寻找空的文件夹项
-  for (off = 0; off < dp->size; off += sizeof(de)) {
-    if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
-      panic("dirlink read");
+  if (!(dp->flags & I_HTREE)) {
+    // 从空位提示开始寻找空的文件夹项 没有就加在末尾
+    // 唯一的块满了就改成哈希索引
+    if ((off = dirscan(dp, dp->dirfree, dp->size, 0, 0)) < 0) {
+      off = dp->size;
+      if (dp->size == BSIZE && htconvert(dp) < 0) {
+        return -1;
+      }
     }
-    if (de.inum == 0) {
-      break;
+  }
+  if (dp->flags & I_HTREE) {
+    // 名字对应的块满了就分裂 直到有空位
+    // 每次分裂要多写两块 次数有上限 事务预留的块才够
+    for (n = 0;; n++) {
+      bn = htleaf(dp, name);
+      if ((off = dirscan(dp, bn * BSIZE, (bn + 1) * BSIZE, 0, 0)) >= 0) {
+        break;
+      }
+      if (n == NHTSPLIT || htsplit(dp, bn) < 0) {
+        return -1;
+      }
     }
   }
   // 配置当前文件夹项
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   // 修改文件夹inode的内容
   if (writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
     return -1;
   }
+  dp->dirfree = off + sizeof(de);
+  // 原来可能缓存着否定项
+  dcinsert(dp, name, inum);
+  return 0;
+}
+
+// 从偏移*poff开始读最多n个在用的文件夹项 读完后*poff指向下一项
+// 名字和inode号写入di 并拿住每一项的inode引用放在ips里 由调用者iput
+// 调用者持有目录dp的锁 返回读到的项数 dp不是目录返回-1
+int dirread(struct inode *dp, uint *poff, struct dirinfo *di,
+            struct inode **ips, int n) {
+  struct buf *bp;
+  struct dirent *de, *e;
+  uint off, addr;
+  int k;
+
+  if (dp->type != T_DIR) {
+    return -1;
+  }
+  off = *poff - *poff % sizeof(*de);
+  k = 0;
+  while (k < n && off < dp->size) {
+    if ((addr = bmap(dp, off / BSIZE)) == 0) {
+      break;
+    }
+    bp = bread(dp->dev, addr);
+    de = (struct dirent *)(bp->data + off % BSIZE);
+    e = de + min(dp->size - off, BSIZE - off % BSIZE) / sizeof(*de);
+    for (; k < n && de < e; de++, off += sizeof(*de)) {
+      if (de->inum == 0) {
+        continue;
+      }
+      di[k].ino = de->inum;
+      memmove(di[k].name, de->name, DIRSIZ);
+      di[k].name[DIRSIZ] = 0;
+      ips[k++] = iget(dp->dev, de->inum);
+    }
+    brelse(bp);
+  }
+  *poff = off;
+  return k;
+}
+
+// 清掉目录dp里偏移off处名为name的文件夹项
+int dirunlink(struct inode *dp, char *name, uint off) {
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if (writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
+    return -1;
+  }
+  if (off < dp->dirfree) {
+    dp->dirfree = off;
+  }
+  dcinval(dp, name);
   return 0;
 }
 
@@ -598,10 +1634,77 @@ static char *skipelem(char *path, char *name) {
   return path;
 }
 
+// 不拿睡眠锁的路径解析 每一级都只查目录项缓存 不读目录也不锁inode
+// 缓存里查不到 或者期间缓存被修改了 返回-1 由调用者走加锁的路径解析
+// 成功返回0 结果放在*pip 文件不存在时*pip是0
+static int namefast(char *path, int nameiparent, char *name,
+                    struct inode **pip) {
+  struct dentry *d;
+  struct inode *ip;
+  uint seq, dev, inum;
+  int n;
+
+  seq = dcache.seq;
+  __sync_synchronize();
+  if (seq & 1) {
+    return -1;
+  }
+  if (*path == '/') {
+    dev = ROOTDEV;
+    inum = ROOTINO;
+  } else {
+    dev = myproc()->cwd->dev;
+    inum = myproc()->cwd->inum;
+  }
+  while ((path = skipelem(path, name)) != 0) {
+    if (nameiparent && *path == '\0') {
+      break;
+    }
+    // 链可能正在被修改 最多走NDCACHE步
+    d = dcache.bucket[dchash(dev, inum, name)];
+    for (n = 0; d != 0 && n < NDCACHE; d = d->hnext, n++) {
+      if (d->dev == dev && d->dir == inum && namecmp(d->name, name) == 0) {
+        break;
+      }
+    }
+    if (d == 0 || n == NDCACHE) {
+      return -1;
+    }
+    d->hot = 1;
+    if ((inum = d->inum) == 0) {
+      break;
+    }
+  }
+  if (inum == 0 || (nameiparent && path == 0)) {
+    __sync_synchronize();
+    if (dcache.seq != seq) {
+      return -1;
+    }
+    *pip = 0;
+    return 0;
+  }
+  // 先拿到引用再确认缓存没变 这样它不会在拿引用之前被删掉释放
+  ip = iget(dev, inum);
+  __sync_synchronize();
+  // 返回的父目录必须是目录 inode还没读进来就交给加锁的路径
+  if (dcache.seq != seq ||
+      (nameiparent && (!ip->valid || ip->type != T_DIR))) {
+    iput(ip);
+    return -1;
+  }
+  *pip = ip;
+  return 0;
+}
+
 // 根据路径寻找文件的inode
 // nameiparent为真 返回路径的文件的目录
+// 先试不加锁的路径解析 不行再一级一级锁目录查
 static struct inode *namex(char *path, int nameiparent, char *name) {
   struct inode *ip, *next;
+
+  if (namefast(path, nameiparent, name, &ip) == 0) {
+    return ip;
+  }
   if (*path == '/') {
     // 从根目录开始找
     ip = iget(ROOTDEV, ROOTINO);
@@ -626,6 +1729,7 @@ static struct inode *namex(char *path, int nameiparent, char *name) {
     }
     // 从当前的文件夹文件描述符中 寻找名为name的文件
     // 此时的name已经是被skipelem裁掉的路径
+    // dirlookup先查目录项缓存 重复的路径不用读目录块
     if ((next = dirlookup(ip, name, 0)) == 0) {
       iunlockput(ip);
       return 0;
@@ -63,6 +63,7 @@ void kfree(void *pa) {
 // 分配一个页 也就是4096字节的物理内存
 void *kalloc(void) {
   struct run *r;
+  int locked;
 
   acquire(&kmem.lock);
   r = kmem.freelist;
@@ -71,6 +72,19 @@ void *kalloc(void) {
     kmem.freelist = r->next;
   }
   release(&kmem.lock);
+  if (r == 0) {
+    // 没有空闲页了 让磁盘缓存或者inode表还一个页回来
+    // 调用者持有自旋锁时不能回收 拿bcache的锁可能和调用者的锁顺序冲突
+    push_off();
+    locked = mycpu()->noff > 1;
+    pop_off();
+    if (!locked) {
+      r = breclaim();
+      if (r == 0) {
+        r = ireclaim();
+      }
+    }
+  }
   if (r) {
     memset((char *)r, 3, PGSIZE);  // 用垃圾填充
   }
@@ -7,115 +7,306 @@
 #include "includes/defs.h"
 #include "includes/sleeplock.h"
 #include "includes/buf.h"
-// logheader放在log区的第一个块里面
+#include "includes/proc.h"
+
+// 一个物理页能放几个buf 快照按页分配
+#define BPP ((int)(PGSIZE / sizeof(struct buf)))
+
+// 磁盘上的logheader从每一半log区的第一个块开始 可以占好几个块
+// 把这几个块看成一个int数组 开头LOGHDR个是n seq sum 后面是各个块号
+// header后面紧跟着存放数据的log块
+#define HDRPB ((int)(BSIZE / sizeof(int)))
+#define LOGHDR 3
+
+// header最多占几个块
+#define MAXHDR ((LOGMAX + LOGHDR + HDRPB - 1) / HDRPB)
+
+// 内存中的logheader 也就是一条提交记录
+// sum覆盖n seq 块号和每个log块的内容
+// header和log块可以同时写 恢复时校验和对不上说明提交没有写完整
 struct logheader {
-  int n;  // n记录了当前有几个块在log区
-  int block[LOGSIZE];
+  int n;     // n记录了当前有几个块在log区
+  uint seq;  // 事务的序号 每次提交加一
+  uint sum;  // 校验和
+  int block[LOGMAX];
 };
 
+// 每一半log区上的记录的状态
+#define REC_CLEAN 0   // 记录里的块都写回原位置了 这一半可以复用
+#define REC_COMMIT 1  // 正在提交 还没落盘
+#define REC_DIRTY 2   // 已经提交 还有块只在缓存和这条记录里
+
 // 内存中维护的log变量
+// log区分成两半 轮流存放提交记录 序号为seq的事务写在seq%2那一半
+// 提交之后块不马上写回原位置 只在缓存里标记成脏的
+// 一半被再次使用之前 先做检查点 把这条记录里还没被新记录覆盖的块
+// 从快照写回原位置 每个事务都改的块(位图 inode块)就这样被合并写了
+// lh收集正在运行的事务 拍完快照就不再碰缓存 新的操作可以和写盘同时进行
 struct log {
   struct spinlock lock;  // 操作这个结构的锁
   int start;             // log区的开始block
   int size;              // log区block数
+  int half;              // 每一半的block数
+  int nhdr;              // 每一半header占的block数
+  int cap;               // 每一半能放的数据块数 也就是一个事务最多多少块
   int outstanding;       // 多少系统调用在执行
-  int committing;        // 标识是不是正在提交
+  int reserved;          // 进行中的操作一共预留了多少块
+  int committing;        // 日志线程在等操作结束和拍快照 此时挡住begin_op
+  int waiting;           // 因为log区空间不够而睡眠的begin_op数
+  uint txstart;          // 运行中的事务第一个块进来时的ticks
+  uint seq;              // 运行中的事务提交时用的序号
+  uint durable;          // 已经落盘的最新事务的序号
+  int syncing;           // 在log_sync里等提交的进程数
   int dev;               // 设备号
-  struct logheader lh;   // 磁盘中的logheader 内存中存一份
+  struct logheader lh;   // 运行中的事务
+
+  // 两半log区上的提交记录 最新的一条是rec[(seq - 1) % 2]
+  struct logheader rec[2];
+  int state[2];                   // REC_开头的状态
+  uint rectick[2];                // 提交完成时的ticks
+  struct buf *pinned[2][LOGMAX];  // 记录里的块在缓存里的buf 检查点之前一直pin着
+  struct sleeplock ckptlock;      // 日志线程和写回线程都会做检查点
+
+  // 有序模式下 文件数据块不进日志 只记下来pin住
+  // 提交时先写回原位置 再写header
+  int ordered;                   // superblock里有FS_ORDERED
+  int ndata;                     // 运行中的事务有多少数据块
+  int cndata;                    // 正在提交的事务有多少数据块
+  struct buf *data[LOGMAX];      // 运行中的事务的数据块
+  struct buf *cdata[LOGMAX];     // 正在提交的事务的数据块
 };
 
 struct log log;
 
+// 提交用的快照 不在缓存的哈希表里 每一半一组
+// 先用它们写log区 检查点的时候再用它们写回原来的位置
+// 个数跟着log区大小 挂载的时候按页分配
+static struct buf *snap[2][LOGMAX];
+
 static void recover_from_log(void);
 static void commit();
+static void log_flusher(void);
+static void log_writeback(void);
 
 // 初始化日志系统 被fsinit调用 第一次创建进程的时候执行
+// log区的大小以superblock为准
 void initlog(int dev, struct superblock *sb) {
-  // logheader一定要小于一个块
-  if (sizeof(struct logheader) >= BSIZE) {
-    panic("initlog: too big logheader");
-  }
+  struct buf *page = 0;
+  int h, i, k;
 
   initlock(&log.lock, "log");
+  initsleeplock(&log.ckptlock, "logckpt");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.half = log.size / 2;
   log.dev = dev;
+  log.ordered = (sb->flags & FS_ORDERED) != 0;
+  // header要放得下开头的几个字段和cap个块号
+  for (log.nhdr = 1; (log.half - log.nhdr + LOGHDR) > log.nhdr * HDRPB;
+       log.nhdr++) {
+  }
+  log.cap = log.half - log.nhdr;
+  if (log.cap < 2 * DIROPBLOCKS || log.cap > LOGMAX) {
+    panic("initlog: bad log size");
+  }
+  k = 0;
+  for (h = 0; h < 2; h++) {
+    for (i = 0; i < log.cap; i++, k++) {
+      if (k % BPP == 0 && (page = (struct buf *)kalloc()) == 0) {
+        panic("initlog: kalloc");
+      }
+      snap[h][i] = page + k % BPP;
+      memset(snap[h][i], 0, sizeof(struct buf));
+      initsleeplock(&snap[h][i]->lock, "logsnap");
+      snap[h][i]->dev = dev;
+    }
+  }
   // 如果有没写回的块 在此处恢复
   recover_from_log();
+  log.durable = log.seq - 1;
+  // 之后的提交都由日志线程来做 写回由写回线程来做
+  if (kthread_create("logflush", log_flusher) < 0 ||
+      kthread_create("logwb", log_writeback) < 0) {
+    panic("initlog: kthread");
+  }
 }
 
-// 提交事务 将log区内容拷贝到原本的位置
-static void install_trans(int recovering) {
-  int tail;
-  for (tail = 0; tail < log.lh.n; tail++) {
-    // 根据logheader中的n提交
-    // 利用buf把log区的block加载进来
-    struct buf *lbuf = bread(log.dev, log.start + tail + 1);
-    // 利用buf载入实际需要写入的block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]);
-    // 写入buf
-    memmove(dbuf->data, lbuf->data, BSIZE);
-    // buf写回
-    bwrite(dbuf);
-    if (recovering == 0) {
-      bunpin(dbuf);
+// 单个操作最多能预留的块数 留一半给别的操作
+int log_maxop(void) { return log.cap / 2; }
+
+// 第h半log区的第一个块
+static int halfstart(int h) { return log.start + h * log.half; }
+
+// 计算提交记录的校验和 log块的内容取自这一半的快照
+static uint logsum(struct logheader *r, int h) {
+  uint sum = 2166136261U;
+  uint *w;
+  int i, j;
+
+  sum = (sum ^ r->n) * 16777619U;
+  sum = (sum ^ r->seq) * 16777619U;
+  for (i = 0; i < r->n; i++) {
+    sum = (sum ^ r->block[i]) * 16777619U;
+    w = (uint *)snap[h][i]->data;
+    for (j = 0; j < BSIZE / (int)sizeof(uint); j++) {
+      sum = (sum ^ w[j]) * 16777619U;
     }
-    brelse(lbuf);
-    brelse(dbuf);
   }
+  return sum;
 }
 
-// 读磁盘的log header到内存
-static void read_head(void) {
-  // 读日志区的第一个block
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *)(buf->data);
+// 读第h半的log header到rec[h]
+// 写了一半的header可能是乱的 n不合理就当作没有记录
+static void read_head(int h) {
+  struct logheader *r = &log.rec[h];
+  // 读这一半的第一个block
+  struct buf *buf = bread(log.dev, halfstart(h));
+  int *hb = (int *)(buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+
+  r->n = hb[0];
+  r->seq = hb[1];
+  r->sum = hb[2];
+  if (r->n < 0 || r->n > log.cap) {
+    r->n = 0;
+  }
+  for (i = LOGHDR; i < LOGHDR + r->n; i++) {
+    if (i % HDRPB == 0) {
+      // 接着读下一个header块
+      brelse(buf);
+      buf = bread(log.dev, halfstart(h) + i / HDRPB);
+      hb = (int *)(buf->data);
+    }
+    r->block[i - LOGHDR] = hb[i % HDRPB];
   }
   brelse(buf);
 }
 
-// 写磁盘header
-static void write_head(void) {
-  struct buf *buf = bread(log.dev, log.start);
+// 把第h半的记录读进快照并校验 校验不过的记录当作不存在
+// 返回记录是否有效
+static int load_rec(int h) {
+  struct logheader *r = &log.rec[h];
+  int i;
+
+  read_head(h);
+  for (i = 0; i < r->n; i++) {
+    // 利用buf把log区的block加载进来
+    struct buf *lbuf = bread(log.dev, halfstart(h) + log.nhdr + i);
+    memmove(snap[h][i]->data, lbuf->data, BSIZE);
+    brelse(lbuf);
+  }
+  if (logsum(r, h) != r->sum) {
+    // 提交的时候崩了 这个事务不算数
+    r->n = 0;
+    return 0;
+  }
+  return 1;
+}
 
-  struct logheader *hb = (struct logheader *)(buf->data);
+// 故障恢复 把第h半记录的快照拷贝到原本的位置
+// 写请求一起提交给磁盘 统一等待
+// 记录不会被清掉 下次挂载还会重放一遍 结果是一样的
+static void install_trans(int h) {
+  struct logheader *r = &log.rec[h];
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+
+  for (i = 0; i < r->n; i++) {
+    acquiresleep(&snap[h][i]->lock);
+    snap[h][i]->blockno = r->block[i];
+    bwrite_async(snap[h][i]);
+  }
+  for (i = 0; i < r->n; i++) {
+    bwait(snap[h][i]);
+    releasesleep(&snap[h][i]->lock);
+  }
+}
+
+// 提交写第h半header的请求 只写用到的header块
+// 返回用到的块数 调用者用wait_head等它们写完
+static struct buf *hbuf[MAXHDR];
+static int write_head(int h) {
+  struct logheader *r = &log.rec[h];
+  int *hb;
+  int i, k, nb;
+
+  nb = (LOGHDR + r->n + HDRPB - 1) / HDRPB;
+  for (k = 0; k < nb; k++) {
+    hbuf[k] = bread(log.dev, halfstart(h) + k);
+    hb = (int *)(hbuf[k]->data);
+    for (i = k * HDRPB; i < (k + 1) * HDRPB && i < LOGHDR + r->n; i++) {
+      if (i == 0) {
+        hb[0] = r->n;
+      } else if (i == 1) {
+        hb[1] = r->seq;
+      } else if (i == 2) {
+        hb[2] = r->sum;
+      } else {
+        hb[i % HDRPB] = r->block[i - LOGHDR];
+      }
+    }
+    bwrite_async(hbuf[k]);
+  }
+  return nb;
+}
+
+static void wait_head(int nb) {
+  int k;
+
+  for (k = 0; k < nb; k++) {
+    bwait(hbuf[k]);
+    brelse(hbuf[k]);
   }
-  // 为数不多的bwrite
-  bwrite(buf);
-  brelse(buf);
 }
 
 // 从故障恢复
+// 两半上有效的记录按序号从旧到新重放
 static void recover_from_log() {
-  // 读入log header到内存
-  read_head();
-  install_trans(1);  // 如果有未处理提交 log区数据拷贝到磁盘
+  int ok0, ok1, first;
+
+  ok0 = load_rec(0);
+  ok1 = load_rec(1);
+  first = (ok0 && ok1 && log.rec[1].seq < log.rec[0].seq) ? 1 : 0;
+  install_trans(first);
+  install_trans(!first);
+  // 两条记录都在原位置了 不用做检查点
+  // 但是记录还在磁盘上 log_data要看最新的那条
+  log.state[0] = log.state[1] = REC_CLEAN;
+  if (ok0 && ok1) {
+    log.seq = log.rec[!first].seq + 1;
+  } else if (ok0 || ok1) {
+    log.seq = log.rec[ok0 ? 0 : 1].seq + 1;
+  } else {
+    log.seq = 1;
+  }
   log.lh.n = 0;
-  write_head();  // 清理日志
 }
 
-// 开始文件系统的操作
-void begin_op() {
+// 开始文件系统的操作 预留MAXOPBLOCKS个log块
+void begin_op() { begin_opn(MAXOPBLOCKS); }
+
+// 开始一个最多写n个块的文件系统操作
+// 预留记在进程上 end_op的时候还回去
+void begin_opn(int n) {
+  if (n > log_maxop()) {
+    panic("begin_opn");
+  }
   acquire(&log.lock);
 
   while (1) {
     if (log.committing) {
-      // 有别的进程在提交
+      // 日志线程在收尾上一个事务
       sleep(&log, &log.lock);
-    } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
-      // log区没空间了
+    } else if (log.lh.n + log.ndata + log.reserved + n > log.cap) {
+      // log区没空间了 叫日志线程马上提交
+      log.waiting += 1;
+      wakeup(&ticks);
       sleep(&log, &log.lock);
+      log.waiting -= 1;
     } else {
       // outstanding加一
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logrsv = n;
       release(&log.lock);
       break;
     }
@@ -123,57 +314,236 @@ void begin_op() {
 }
 
 // 结束文件系统的操作
+// 不再由最后一个离开的进程提交 交给日志线程攒批
 void end_op(void) {
-  int do_commit = 0;
   acquire(&log.lock);
   log.outstanding -= 1;
-  if (log.committing) {
-    panic("log.committing");
+  log.reserved -= myproc()->logrsv;
+  myproc()->logrsv = 0;
+  // 唤醒等空间的begin_op 以及等操作结束的日志线程
+  wakeup(&log);
+  if (log.lh.n + log.ndata >= log.cap / LOGFLUSHFRAC) {
+    // 攒够了 不用等到超时
+    wakeup(&ticks);
   }
-  if (log.outstanding == 0) {
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // 如果log.outstanding不为0 说明可能有begin_op在等
-    // 减少了outstanding后 可以唤醒begin_op
-    wakeup(&log);
+  release(&log.lock);
+}
+
+// 等到已经结束的操作都提交落盘 不等超时 叫日志线程马上提交
+// 调用者不能在事务里
+void log_sync(void) {
+  uint target;
+
+  acquire(&log.lock);
+  target = log.seq;
+  if (log.lh.n + log.ndata == 0 && !log.committing) {
+    // 运行中的事务是空的 只用等正在提交的上一个
+    target--;
   }
+  log.syncing += 1;
+  while (log.durable < target) {
+    wakeup(&ticks);
+    sleep(&log, &log.lock);
+  }
+  log.syncing -= 1;
   release(&log.lock);
+}
 
-  if (do_commit) {
-    commit();
+// 做第h半的检查点
+// 记录里还没被更新的记录覆盖的块 按块号排好序从快照写回原位置
+// 写完之后放掉对缓存块的pin 这一半就可以复用了
+static int ckidx[LOGMAX];
+static struct buf *ckbuf[LOGMAX];
+static void checkpoint(int h) {
+  struct logheader *r = &log.rec[h];
+  int i, j, k, n;
+
+  acquiresleep(&log.ckptlock);
+  if (log.state[h] != REC_DIRTY) {
+    releasesleep(&log.ckptlock);
+    return;
+  }
+  n = 0;
+  acquire(&log.lock);
+  for (i = 0; i < r->n; i++) {
+    // 块号排序 插入排序就够了
+    if (log.pinned[h][i]->dseq == r->seq) {
+      for (j = n; j > 0 && r->block[ckidx[j - 1]] > r->block[i]; j--) {
+        ckidx[j] = ckidx[j - 1];
+      }
+      ckidx[j] = i;
+      n++;
+    }
+  }
+  release(&log.lock);
+
+  // 块号连续的快照合成一个磁盘请求
+  for (k = 0; k < n; k++) {
+    ckbuf[k] = snap[h][ckidx[k]];
+    acquiresleep(&ckbuf[k]->lock);
+    ckbuf[k]->blockno = r->block[ckidx[k]];
+  }
+  bwritev_async(ckbuf, n);
+  for (k = 0; k < n; k++) {
+    bwait(ckbuf[k]);
+    releasesleep(&ckbuf[k]->lock);
+  }
+
+  acquire(&log.lock);
+  for (i = 0; i < r->n; i++) {
+    // 期间又被新的记录提交了的块 还是脏的
+    if (log.pinned[h][i]->dseq == r->seq) {
+      log.pinned[h][i]->dseq = 0;
+    }
+  }
+  // 写回原位置的请求都完成了 这一半的记录就可以被覆盖
+  // 磁盘协商时去掉了FLUSH 是直写的 写完成就已经落盘 不用再刷缓存
+  log.state[h] = REC_CLEAN;
+  release(&log.lock);
+  for (i = 0; i < r->n; i++) {
+    bunpin(log.pinned[h][i]);
+  }
+  releasesleep(&log.ckptlock);
+}
+
+// 日志线程 把一段时间里各个进程的操作合成一个事务提交
+// 空闲时睡在ticks上 时钟中断每个tick唤醒一次检查是否超时
+// 攒够块数或者有begin_op等空间时 也会被直接唤醒
+static void log_flusher(void) {
+  acquire(&log.lock);
+  while (1) {
+    if (log.lh.n + log.ndata == 0 ||
+        (log.waiting == 0 && log.syncing == 0 &&
+         log.lh.n + log.ndata < log.cap / LOGFLUSHFRAC &&
+         ticks - log.txstart < LOGFLUSHTICKS)) {
+      sleep(&ticks, &log.lock);
+      continue;
+    }
+    // 要用的那一半先做完检查点 不挡住新的操作
+    release(&log.lock);
+    checkpoint(log.seq % 2);
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    // 挡住新的操作 等进行中的操作都结束 事务才是完整的
+    log.committing = 1;
+    while (log.outstanding > 0) {
+      sleep(&log, &log.lock);
+    }
     release(&log.lock);
+    commit();
+    acquire(&log.lock);
   }
 }
 
-// 先把cache中的数据写到log
-// 这里打开的from 应该在buf中有缓存
-// 且其中的buf已经被修改了
-static void write_log(void) {
+// 写回线程 记录提交之后过了LOGWBTICKS还没做检查点的话 在这里做
+// 这样空闲的时候脏块也会慢慢写回 日志线程复用那一半时就不用等了
+static void log_writeback(void) {
+  int h;
+
+  acquire(&log.lock);
+  while (1) {
+    sleep(&ticks, &log.lock);
+    // 旧的记录先做
+    h = log.seq % 2;
+    if (log.state[h] != REC_DIRTY || ticks - log.rectick[h] < LOGWBTICKS) {
+      h = !h;
+    }
+    if (log.state[h] == REC_DIRTY && ticks - log.rectick[h] >= LOGWBTICKS) {
+      release(&log.lock);
+      checkpoint(h);
+      acquire(&log.lock);
+    }
+  }
+}
+
+// 先把快照写到第h半log区 只提交请求 由调用者等待
+// log块是连续的 一个请求能带NCLUSTER个
+static void write_log(int h) {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start + tail + 1);
-    struct buf *from = bread(log.dev, log.lh.block[tail]);
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.rec[h].n; tail++) {
+    snap[h][tail]->blockno = halfstart(h) + log.nhdr + tail;
   }
+  bwritev_async(snap[h], log.rec[h].n);
 }
 
-// 执行提交
+// 执行提交 由日志线程调用 此时没有进行中的操作 新的操作被挡住
+// 这一半已经做过检查点了
 static void commit() {
-  if (log.lh.n > 0) {
-    write_log();       // 写回cache到日志层数据块
-    write_head();      // 写磁盘的logheader
-    install_trans(0);  // 写回数据到block
-    log.lh.n = 0;      // 清空log
-    write_head();      // 把清空的log写入header
+  int h = log.seq % 2;
+  struct logheader *r = &log.rec[h];
+  int i, j, nb;
+
+  // 运行中的事务换到这一半的记录里
+  r->n = log.lh.n;
+  r->seq = log.seq;
+  for (i = 0; i < log.lh.n; i++) {
+    r->block[i] = log.lh.block[i];
+  }
+  // 给每个块拍快照 这之后新的事务再改缓存也不影响这次提交
+  // log_write时的pin留着 直到检查点 否则被换出后会读到旧数据
+  for (i = 0; i < r->n; i++) {
+    struct buf *b = bread(log.dev, r->block[i]);
+    acquiresleep(&snap[h][i]->lock);
+    memmove(snap[h][i]->data, b->data, BSIZE);
+    log.pinned[h][i] = b;
+    brelse(b);
+  }
+  // 数据块不拍快照 拿着睡眠锁直接提交写请求
+  // 新的操作要改这些块 得等它们写完
+  // 按块号排好序 文件里连续的块合成一个磁盘请求
+  log.cndata = log.ndata;
+  for (i = 0; i < log.ndata; i++) {
+    struct buf *b = log.data[i];
+    for (j = i; j > 0 && log.cdata[j - 1]->blockno > b->blockno; j--) {
+      log.cdata[j] = log.cdata[j - 1];
+    }
+    log.cdata[j] = b;
+  }
+  for (i = 0; i < log.cndata; i++) {
+    acquiresleep(&log.cdata[i]->lock);
+  }
+  bwritev_async(log.cdata, log.cndata);
+
+  // 放新的操作进来
+  acquire(&log.lock);
+  log.lh.n = 0;
+  log.ndata = 0;
+  log.seq++;
+  log.state[h] = REC_COMMIT;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log(h);  // 快照写到日志层数据块 不等待
+  // 数据块要在header之前落盘 否则提交的inode可能指向旧内容
+  // 磁盘没有协商FLUSH 是直写的 等到写请求完成就是落盘了 不用另外刷缓存
+  for (i = 0; i < log.cndata; i++) {
+    bwait(log.cdata[i]);
+    releasesleep(&log.cdata[i]->lock);
+    bunpin(log.cdata[i]);
+  }
+  log.cndata = 0;
+
+  // header和log块一起写 不用等log块写完 有校验和兜底
+  // 只有数据块的事务也写一条空记录 把这一半上的旧记录作废
+  r->sum = logsum(r, h);
+  nb = write_head(h);
+  for (i = 0; i < r->n; i++) {
+    bwait(snap[h][i]);
+    releasesleep(&snap[h][i]->lock);
+  }
+  wait_head(nb);  // 都写完了才算提交
+
+  // 块先不写回原位置 标记成脏的 等检查点
+  acquire(&log.lock);
+  for (i = 0; i < r->n; i++) {
+    log.pinned[h][i]->dseq = r->seq;
   }
+  log.state[h] = r->n > 0 ? REC_DIRTY : REC_CLEAN;
+  log.rectick[h] = ticks;
+  log.durable = r->seq;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // 系统调用使用这个函数写入
@@ -185,16 +555,28 @@ static void commit() {
 // buf块的引用次数也自增了
 // 实际上修改的是buf
 void log_write(struct buf *b) {
-  int i;
+  int i, pinned;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) {
+  if (log.lh.n + log.ndata >= log.cap) {
     panic("too big a transaction");
   }
   if (log.outstanding < 1) {
     panic("log_write outside of trans");
   }
 
+  // 这个事务里已经log_data过的块(比如新分配时清零的元数据块)
+  // 从数据块里拿掉 改成只走日志 不然预留里算两次 提交时还写两遍
+  // 块上已经有数据块那份pin 直接转给日志
+  pinned = 0;
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i]->blockno == b->blockno) {
+      log.data[i] = log.data[--log.ndata];
+      pinned = 1;
+      break;
+    }
+  }
+
   // 修改log header的block区
   for (i = 0; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno) {
@@ -204,8 +586,69 @@ void log_write(struct buf *b) {
   log.lh.block[i] = b->blockno;
   // 自增log header 的n
   if (i == log.lh.n) {
-    bpin(b);
+    if (!pinned) {
+      bpin(b);
+      if (log.lh.n + log.ndata == 0) {
+        // 事务的第一个块 超时从这里开始算
+        log.txstart = ticks;
+      }
+    }
     log.lh.n++;
   }
   release(&log.lock);
 }
+
+// 写文件数据块 用法和log_write一样
+// 有序模式下只把块记在事务上并pin住 提交时在header之前写回原位置
+// 这样数据只写一遍 也不会出现提交了的inode指向没写过的块
+// 数据块也算在日志的预留里 这样记录的个数有上限
+void log_data(struct buf *b) {
+  struct logheader *r;
+  int i;
+
+  if (!log.ordered) {
+    log_write(b);
+    return;
+  }
+
+  acquire(&log.lock);
+  if (log.lh.n + log.ndata >= log.cap) {
+    panic("too big a transaction");
+  }
+  if (log.outstanding < 1) {
+    panic("log_data outside of trans");
+  }
+
+  // 最新的记录在这个事务提交之后还会被重放
+  // 块在那条记录里的话 直接写下去的数据会被盖掉 这种块还是走日志
+  r = &log.rec[(log.seq - 1) % 2];
+  for (i = 0; i < r->n; i++) {
+    if (r->block[i] == b->blockno) {
+      release(&log.lock);
+      log_write(b);
+      return;
+    }
+  }
+
+  // 这个事务里已经走日志的块 提交时会整块写进日志 不用再记一遍
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == b->blockno) {
+      release(&log.lock);
+      return;
+    }
+  }
+
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b) {
+      break;
+    }
+  }
+  if (i == log.ndata) {
+    bpin(b);
+    if (log.lh.n + log.ndata == 0) {
+      log.txstart = ticks;
+    }
+    log.data[log.ndata++] = b;
+  }
+  release(&log.lock);
+}
@@ -96,7 +96,7 @@ void pipeclose(struct pipe *pi, int writable) {
 // 向管道里面写入数据
 // 管道结构 用户地址 写入的字节数
 int pipewrite(struct pipe *pi, uint64 addr, int n) {
-  int i = 0;
+  int i = 0, k;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -114,14 +114,21 @@ int pipewrite(struct pipe *pi, uint64 addr, int n) {
       // 等待读进程唤醒本次写进程
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      // 逐字节拷贝用户空间的数据到内核空间
-      if (copyin(pr->pagetable, &ch, addr + i, 1) == -1) {
+      // 一次拷贝一段连续的空位 到缓冲区末尾或者空位用完为止
+      k = PIPESIZE - pi->nwrite % PIPESIZE;
+      if (k > pi->nread + PIPESIZE - pi->nwrite) {
+        k = pi->nread + PIPESIZE - pi->nwrite;
+      }
+      if (k > n - i) {
+        k = n - i;
+      }
+      if (copyin(pr->pagetable, pi->data + pi->nwrite % PIPESIZE, addr + i,
+                 k) == -1) {
         break;
       }
-      // 写入管道 并且写头+1
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      // 写入管道 并且移动写头
+      pi->nwrite += k;
+      i += k;
     }
   }
   wakeup(&pi->nread);  // 写完了唤醒读进程
@@ -130,11 +137,58 @@ int pipewrite(struct pipe *pi, uint64 addr, int n) {
   return i;
 }
 
+// 从内核地址src往管道里放最多n个字节 管道满了也不睡眠
+// 返回放进去的字节数 没有读者了返回-1
+int pipeput(struct pipe *pi, char *src, int n) {
+  int i, m, k;
+
+  acquire(&pi->lock);
+  if (pi->readopen == 0) {
+    release(&pi->lock);
+    return -1;
+  }
+  m = PIPESIZE - (pi->nwrite - pi->nread);
+  if (m > n) {
+    m = n;
+  }
+  // 环形缓冲区绕回的地方分成两段拷贝
+  for (i = 0; i < m; i += k) {
+    k = PIPESIZE - pi->nwrite % PIPESIZE;
+    if (k > m - i) {
+      k = m - i;
+    }
+    memmove(pi->data + pi->nwrite % PIPESIZE, src + i, k);
+    pi->nwrite += k;
+  }
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return i;
+}
+
+// 睡眠等到管道有空位 没有读者了或者进程被杀死返回-1
+int pipewait(struct pipe *pi) {
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while (pi->nwrite == pi->nread + PIPESIZE) {
+    if (pi->readopen == 0 || killed(pr)) {
+      break;
+    }
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if (pi->readopen == 0 || killed(pr)) {
+    release(&pi->lock);
+    return -1;
+  }
+  release(&pi->lock);
+  return 0;
+}
+
 // 管道读
 int piperead(struct pipe *pi, uint64 addr, int n) {
-  int i;
+  int i, k;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   // 如果管道没有数据可读 并且管道还是可写的 睡眠等待写进程写入数据
@@ -146,15 +200,20 @@ int piperead(struct pipe *pi, uint64 addr, int n) {
     }
     sleep(&pi->nread, &pi->lock);
   }
-  // 逐字节拷贝数据到用户空间
-  for (i = 0; i < n; i++) {
-    if (pi->nread == pi->nwrite) {
-      break;
+  // 按连续的段拷贝数据到用户空间 缓冲区绕回的时候最多拷贝两次
+  for (i = 0; i < n && pi->nread != pi->nwrite; i += k) {
+    k = PIPESIZE - pi->nread % PIPESIZE;
+    if (k > pi->nwrite - pi->nread) {
+      k = pi->nwrite - pi->nread;
+    }
+    if (k > n - i) {
+      k = n - i;
     }
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if (copyout(pr->pagetable, addr + i, &ch, 1) == -1) {
+    if (copyout(pr->pagetable, addr + i, pi->data + pi->nread % PIPESIZE, k) ==
+        -1) {
       break;
     }
+    pi->nread += k;
   }
   wakeup(&pi->nwrite);  // 读完了唤醒写进程
   release(&pi->lock);
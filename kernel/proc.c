@@ -162,6 +162,8 @@ static void freeproc(struct proc* p) {
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->kfn = 0;
+  p->ioring = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -356,6 +358,33 @@ void forkret(void) {
   usertrapret();
 }
 
+// 内核线程第一次被调度的时候 会指向这里
+// 和forkret一样先释放scheduler拿到的锁 然后执行线程函数 不会回到用户态
+static void kthreadret(void) {
+  struct proc* p = myproc();
+  release(&p->lock);
+  p->kfn();
+  panic("kthread return");
+}
+
+// 创建一个只在内核里运行的线程 fn不能返回
+// 用的还是进程表里的槽位 只是不会有用户态的内存
+int kthread_create(char* name, void (*fn)(void)) {
+  struct proc* p;
+  int pid;
+
+  if ((p = allocproc()) == 0) {
+    return -1;
+  }
+  pid = p->pid;
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+  return pid;
+}
+
 // 进程停止工作并且睡眠到chan上
 // 这里的进程一定是进程的内核进程
 // 而不是用户进程 或者说用户进程已经陷入之后才可以执行这里的sleep
@@ -29,6 +29,14 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_ioring_setup(void);
+extern uint64 sys_ioring_enter(void);
+extern uint64 sys_sendfile(void);
 
 // 系统调用列表 函数指针列表
 // 映射调用号到实际的系统调用函数
@@ -40,6 +48,10 @@ static uint64 (*syscalls[])(void) = {
     [SYS_sleep] sys_sleep, [SYS_uptime] sys_uptime, [SYS_open] sys_open,
     [SYS_write] sys_write, [SYS_mknod] sys_mknod,   [SYS_unlink] sys_unlink,
     [SYS_link] sys_link,   [SYS_mkdir] sys_mkdir,   [SYS_close] sys_close,
+    [SYS_getdents] sys_getdents, [SYS_pread] sys_pread,
+    [SYS_pwrite] sys_pwrite,     [SYS_readv] sys_readv,
+    [SYS_writev] sys_writev,     [SYS_ioring_setup] sys_ioring_setup,
+    [SYS_ioring_enter] sys_ioring_enter, [SYS_sendfile] sys_sendfile,
 };
 
 void syscall(void) {
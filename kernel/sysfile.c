@@ -12,6 +12,7 @@
 #include "includes/file.h"
 #include "includes/stat.h"
 #include "includes/fcntl.h"
+#include "includes/ioring.h"
 
 // 传入文件描述符的参数的下标n
 // 取参数的值作为文件描述符 检查其正确性
@@ -49,6 +50,9 @@ static int fdalloc(struct file *f) {
   return -1;
 }
 
+static int fdclose(int fd);
+static int fileopen(char *path, int omode);
+
 // 增加文件的引用次数 返回一个新的文件描述符
 // 只有一个参数是文件描述符
 uint64 sys_dup(void) {
@@ -106,15 +110,126 @@ uint64 sys_write(void) {
   return filewrite(f, p, n);
 }
 
+// 在指定偏移读写 不改变文件的偏移 多个进程共用一个文件时不用互相等偏移
+// 第一个参数是文件描述符 第二个参数是用户态的地址
+// 第三个参数是大小 第四个参数是文件里的偏移
+uint64 sys_pread(void) {
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+  uint o;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if (argfd(0, 0, &f) < 0 || n < 0 || off < 0) {
+    return -1;
+  }
+  iov.base = (void *)p;
+  iov.len = n;
+  o = off;
+  return filereadv(f, &iov, 1, &o);
+}
+
+uint64 sys_pwrite(void) {
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+  uint o;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if (argfd(0, 0, &f) < 0 || n < 0 || off < 0) {
+    return -1;
+  }
+  iov.base = (void *)p;
+  iov.len = n;
+  o = off;
+  return filewritev(f, &iov, 1, &o);
+}
+
+// 在内核里把一个文件的内容送到管道或者另一个文件 不经过用户空间
+// 第一个参数是目标文件描述符 第二个参数是源文件描述符 源必须是普通文件
+// 第三个参数是大小 从源的当前偏移开始 返回送出的字节数
+uint64 sys_sendfile(void) {
+  struct file *out, *in;
+  int n;
+
+  argint(2, &n);
+  if (argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0) {
+    return -1;
+  }
+  return filesend(out, in, n);
+}
+
+// 取第n个参数指向的用户态iovec数组 第n+1个参数是段数
+// 拷贝到内核的iov 返回段数 段数或者总长度不对返回-1
+static int argiov(int n, struct iovec *iov) {
+  uint64 p;
+  int cnt, i;
+  uint tot;
+
+  argaddr(n, &p);
+  argint(n + 1, &cnt);
+  if (cnt < 0 || cnt > NIOV) {
+    return -1;
+  }
+  if (copyin(myproc()->pagetable, (char *)iov, p, cnt * sizeof(*iov)) < 0) {
+    return -1;
+  }
+  // 总长度要能用返回值表示
+  for (tot = 0, i = 0; i < cnt; i++) {
+    if (iov[i].len > 0x7fffffff - tot) {
+      return -1;
+    }
+    tot += iov[i].len;
+  }
+  return cnt;
+}
+
+// 分段读写 一次系统调用读写多个缓冲区 写的时候尽量放在一个事务里
+// 第一个参数是文件描述符 第二个参数是iovec数组 第三个参数是段数
+uint64 sys_readv(void) {
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if (argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0) {
+    return -1;
+  }
+  return filereadv(f, iov, cnt, 0);
+}
+
+uint64 sys_writev(void) {
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if (argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0) {
+    return -1;
+  }
+  return filewritev(f, iov, cnt, 0);
+}
+
 // 关闭文件
 // 第一个参数是文件描述符
 uint64 sys_close(void) {
   int fd;
-  struct file *f;
   // 检查文件描述符的正确性
-  if (argfd(0, &fd, &f) < 0) {
+  if (argfd(0, &fd, 0) < 0) {
     return -1;
   }
+  return fdclose(fd);
+}
+
+// 关闭文件描述符fd 调用者检查过fd是打开的
+static int fdclose(int fd) {
+  struct file *f;
+
+  f = myproc()->ofile[fd];
   myproc()->ofile[fd] = 0;
   // 关闭文件 减少引用 实际上操作的是文件结构
   fileclose(f);
@@ -135,6 +250,23 @@ uint64 sys_fstat(void) {
   return filestat(f, st);
 }
 
+// 一次读多个文件夹项
+// 第一个参数是文件夹的文件描述符
+// 第二个参数是用户态dirinfo数组的地址 第三个参数是数组能放几项
+// 返回读到的项数 读完了返回0
+uint64 sys_getdents(void) {
+  struct file *f;
+  uint64 p;
+  int n;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if (argfd(0, 0, &f) < 0 || n < 0) {
+    return -1;
+  }
+  return filegetdents(f, p, n);
+}
+
 // 创建一个文件的硬链接
 // 创建一个新的路径连接到相同的Inode上
 // 第一个参数是 老路径
@@ -146,8 +278,8 @@ uint64 sys_link(void) {
   if (argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0) {
     return -1;
   }
-  // 开启事务
-  begin_op();
+  // 开启事务 要往文件夹里加项
+  begin_opn(DIROPBLOCKS);
   // 找到老文件的文件描述符
   if ((ip = namei(old)) == 0) {
     end_op();
@@ -219,7 +351,6 @@ static int isdirempty(struct inode *dp) {
 // 第一个参数是path
 uint64 sys_unlink(void) {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
   // 取第一个参数
@@ -256,10 +387,8 @@ uint64 sys_unlink(void) {
     iunlockput(ip);
     goto bad;
   }
-  // 给预先准备的de写0
-  memset(&de, 0, sizeof(de));
   // 父目录的inode的第off项写0
-  if (writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
+  if (dirunlink(dp, name, off) < 0) {
     panic("unlink: writei");
   }
   // 当一个目录被删除时 需要将父目录的连接次数-1
@@ -349,23 +478,14 @@ fail:
   return 0;
 }
 
-// 打开文件 分配文件描述符
-// 第一个参数是path
-// 第二个参数是模式
-uint64 sys_open(void) {
-  char path[MAXPATH];
-  int fd, omode;
+// 按模式omode打开path 分配文件描述符 失败返回-1
+static int fileopen(char *path, int omode) {
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-  // 取模式
-  argint(1, &omode);
-  // 取path
-  if ((n = argstr(0, path, MAXPATH)) < 0) {
-    return -1;
-  }
-  // 开启事务
-  begin_op();
+
+  // 开启事务 创建文件要往文件夹里加项 预留得多一些
+  begin_opn((omode & O_CREATE) ? DIROPBLOCKS : MAXOPBLOCKS);
   // 如果是创建文件
   if (omode & O_CREATE) {
     //  调用create函数
@@ -438,13 +558,28 @@ uint64 sys_open(void) {
   return fd;
 }
 
+// 打开文件 分配文件描述符
+// 第一个参数是path
+// 第二个参数是模式
+uint64 sys_open(void) {
+  char path[MAXPATH];
+  int omode;
+  // 取模式
+  argint(1, &omode);
+  // 取path
+  if (argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  return fileopen(path, omode);
+}
+
 // 创建文件夹
 // 第一个参数是路径
 uint64 sys_mkdir(void) {
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   // 将路径写入path 然后再path的地方创建一个目录类型的inode
   if (argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0) {
     end_op();
@@ -462,7 +597,7 @@ uint64 sys_mknod(void) {
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   argint(1, &major);
   argint(2, &minor);
   // 路径拷贝到path
@@ -603,3 +738,88 @@ uint64 sys_pipe(void) {
   }
   return 0;
 }
+
+// 登记共享环
+// 第一个参数是ioring在用户态的地址 要按页对齐 传0取消登记
+uint64 sys_ioring_setup(void) {
+  struct proc *p = myproc();
+  uint64 addr;
+
+  argaddr(0, &addr);
+  if (addr != 0 && (addr % PGSIZE != 0 || addr + PGSIZE > p->sz)) {
+    return -1;
+  }
+  p->ioring = addr;
+  return 0;
+}
+
+// 执行一个提交队列的项 返回值放进完成项
+static int ioring_do(struct sqe *e) {
+  struct file *f;
+  struct iovec iov;
+  char path[MAXPATH];
+  uint off;
+
+  if (e->op == IO_OPEN) {
+    if (fetchstr(e->addr, path, MAXPATH) < 0) {
+      return -1;
+    }
+    return fileopen(path, e->len);
+  }
+  if (e->fd < 0 || e->fd >= NOFILE || (f = myproc()->ofile[e->fd]) == 0) {
+    return -1;
+  }
+  iov.base = (void *)e->addr;
+  iov.len = e->len;
+  off = e->off;
+  switch (e->op) {
+    case IO_READ:
+      return filereadv(f, &iov, 1, e->off >= 0 ? &off : 0);
+    case IO_WRITE:
+      return filewritev(f, &iov, 1, e->off >= 0 ? &off : 0);
+    case IO_CLOSE:
+      return fdclose(e->fd);
+    case IO_FSYNC:
+      log_sync();
+      return 0;
+  }
+  return -1;
+}
+
+// 处理共享环里的请求 一次陷入做完一批
+// 第一个参数是最多处理几个请求 返回处理了几个
+// 完成队列满了就先停下 等用户取走结果再调用
+uint64 sys_ioring_enter(void) {
+  struct proc *p = myproc();
+  struct ioring *r;
+  struct sqe e;
+  struct cqe *c;
+  uint64 pa;
+  int n, k, res;
+
+  argint(0, &n);
+  // 环在用户的页里 内核通过直接映射访问同一个物理页
+  if (p->ioring == 0 || (pa = walkaddr(p->pagetable, p->ioring)) == 0) {
+    return -1;
+  }
+  r = (struct ioring *)pa;
+  for (k = 0; k < n && !killed(p); k++) {
+    __sync_synchronize();
+    if (r->sqhead == r->sqtail || r->cqtail - r->cqhead >= NCQE) {
+      break;
+    }
+    // 先拷出来 执行的时候用户改了这一项也不影响
+    e = r->sq[r->sqhead % NSQE];
+    __sync_synchronize();
+    r->sqhead++;
+
+    res = ioring_do(&e);
+
+    c = &r->cq[r->cqtail % NCQE];
+    c->data = e.data;
+    c->res = res;
+    __sync_synchronize();
+    r->cqtail++;
+  }
+  return k;
+}
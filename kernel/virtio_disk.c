@@ -45,10 +45,12 @@ static struct disk {
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // status and done are indexed by first descriptor index of chain,
+  // b by the index of the data descriptor that carries it.
   struct {
     struct buf *b;
     char status;
+    void (*done)(struct buf *);  // completion callback, or 0 to wakeup(b)
   } info[NUM];
 
   // disk command headers.
@@ -85,6 +87,10 @@ void virtio_disk_init(void) {
   uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
+  // without FLUSH the device has to run write-through, so a
+  // completed write is on stable storage. the log's ordering
+  // (data, log blocks, header, checkpoint) depends on that.
+  features &= ~(1 << VIRTIO_BLK_F_FLUSH);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
@@ -182,10 +188,10 @@ static void free_chain(int i) {
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
-static int alloc3_desc(int *idx) {
-  for (int i = 0; i < 3; i++) {
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer of k blocks uses k + 2 descriptors.
+static int alloc_descs(int *idx, int n) {
+  for (int i = 0; i < n; i++) {
     idx[i] = alloc_desc();
     if (idx[i] < 0) {
       for (int j = 0; j < i; j++) free_desc(idx[j]);
@@ -195,25 +201,48 @@ static int alloc3_desc(int *idx) {
   return 0;
 }
 
-void virtio_disk_rw(struct buf *b, int write) {
-  uint64 sector = b->blockno * (BSIZE / 512);
+// queue a read or write of b and return without waiting.
+// the request completes from virtio_disk_intr(), which clears
+// b->disk and then calls done(b) if done is non-zero, or
+// wakes up virtio_disk_wait() otherwise.
+// done runs in interrupt context holding vdisk_lock, so it
+// must not sleep or start new disk requests.
+// sleeps only if all descriptors are in use.
+void virtio_disk_submit(struct buf *b, int write, void (*done)(struct buf *)) {
+  virtio_disk_submitv(&b, 1, write, done);
+}
+
+// like virtio_disk_submit(), but moves n buffers with
+// consecutive block numbers in a single request, one data
+// descriptor per buffer. every buffer completes separately
+// from virtio_disk_intr(), each with its own done() call.
+void virtio_disk_submitv(struct buf **bs, int n, int write,
+                         void (*done)(struct buf *)) {
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  int idx[NUM];
+
+  if (n < 1 || n + 2 > NUM) panic("virtio_disk_submitv");
+  for (int i = 1; i < n; i++) {
+    if (bs[i]->blockno != bs[0]->blockno + i)
+      panic("virtio_disk_submitv: not contiguous");
+  }
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // one descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may be split across
+  // any number of descriptors, so give each buffer its own.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
   while (1) {
-    if (alloc3_desc(idx) == 0) {
+    if (alloc_descs(idx, n + 2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -230,24 +259,29 @@ void virtio_disk_rw(struct buf *b, int write) {
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64)b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if (write)
-    disk.desc[idx[1]].flags = 0;  // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE;  // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for (int i = 0; i < n; i++) {
+    int d = idx[i + 1];
+    disk.desc[d].addr = (uint64)bs[i]->data;
+    disk.desc[d].len = BSIZE;
+    if (write)
+      disk.desc[d].flags = 0;  // device reads b->data
+    else
+      disk.desc[d].flags = VRING_DESC_F_WRITE;  // device writes b->data
+    disk.desc[d].flags |= VRING_DESC_F_NEXT;
+    disk.desc[d].next = idx[i + 2];
+
+    // record struct buf for virtio_disk_intr().
+    bs[i]->disk = 1;
+    disk.info[d].b = bs[i];
+  }
 
   disk.info[idx[0]].status = 0xff;  // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE;  // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n + 1]].addr = (uint64)&disk.info[idx[0]].status;
+  disk.desc[idx[n + 1]].len = 1;
+  disk.desc[idx[n + 1]].flags = VRING_DESC_F_WRITE;  // device writes the status
+  disk.desc[idx[n + 1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].done = done;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -261,17 +295,25 @@ void virtio_disk_rw(struct buf *b, int write) {
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;  // value is queue number
 
+  release(&disk.vdisk_lock);
+}
+
+// wait for a request queued without a callback to finish.
+void virtio_disk_wait(struct buf *b) {
+  acquire(&disk.vdisk_lock);
   // Wait for virtio_disk_intr() to say request has finished.
   while (b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+// synchronous read or write of one block.
+void virtio_disk_rw(struct buf *b, int write) {
+  virtio_disk_submit(b, write, 0);
+  virtio_disk_wait(b);
+}
+
 void virtio_disk_intr() {
   acquire(&disk.vdisk_lock);
 
@@ -294,9 +336,24 @@ void virtio_disk_intr() {
 
     if (disk.info[id].status != 0) panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;  // disk is done with buf
-    wakeup(b);
+    void (*done)(struct buf *) = disk.info[id].done;
+    disk.info[id].done = 0;
+
+    // finish every buffer carried by the chain.
+    for (int d = disk.desc[id].next; disk.info[d].b != 0;
+         d = disk.desc[d].next) {
+      struct buf *b = disk.info[d].b;
+      disk.info[d].b = 0;
+      b->disk = 0;  // disk is done with buf
+      if (done)
+        done(b);
+      else
+        wakeup(b);
+    }
+
+    // the submitter does not wait around to free the chain,
+    // so free it here; this wakes anyone waiting for descriptors.
+    free_chain(id);
 
     disk.used_idx += 1;
   }
@@ -34,6 +34,8 @@ int nbitmap = FSSIZE / (BSIZE * 8) + 1;
 // IPB 是块大小除以inode结构大小 也就是一个块能装多个inode
 // 这里算完ninodeblocks是inode区域所用的块数
 int ninodeblocks = NINODES / IPB + 1;
+// inode位图占的块数 一位表示一个inode是否被分配了
+int nimap = NINODES / (BSIZE * 8) + 1;
 int nlog = LOGSIZE;
 int nmeta;    // 元数据所占区块个数
 int nblocks;  // 数据块个数
@@ -50,12 +52,16 @@ uint freeinode = 1;
 uint freeblock;
 
 void balloc(int);
+void imapinit(int);
 void wsect(uint, void *);
 void winode(uint, struct dinode *);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirwrite(uint inum, struct dirent *ents, int n);
+uint fbmap(struct dinode *din, uint fbn);
+uint efbmap(struct dinode *din, uint fbn);
 void die(const char *);
 
 // 转换字节序为小端序 即在一个数据类型中 字节序和常规的字节序是反的
@@ -79,18 +85,19 @@ uint xint(uint x) {
 }
 
 // 每一个inode表示一个文件 inode中有addr按顺序记录着文件存储在data区的block号
-// addr最后一位记录了一个块号 该块号存的数据结构是 int[256]
-// 每个int指向一个新的块号 相当于二级块表 一个inode可以表示256+12个数据块
-// 一个块1k 所以最大存储文件是268kb
+// addr后三位记录了一级 二级 三级间接索引块的块号 索引块存的数据结构是 int[256]
+// 每个int指向下一级索引块或者数据块 一个inode可以表示
+// 10+256+256^2+256^3个数据块 实际最大文件受size字段限制在4GB以内
 // dinode是文件系统的文件索引节点结构
 // 当一个inode是文件夹类型的时候 该inode指向的文件（块）中
 // 顺序排布着dirent[] 结构
 int main(int argc, char *argv[]) {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
+  static struct dirent rootents[NINODES + 2];
+  int nroot;
 
   // 断言int是4 否则不允许在该操作系统使用mkfs
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -111,8 +118,8 @@ int main(int argc, char *argv[]) {
 
   // 元信息包括一个boot块 一个superblock n个log
   // n个inode块（算出来的200个inode占多少）
-  // n个位图块
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  // n个inode位图块 n个位图块
+  nmeta = 2 + nlog + ninodeblocks + nimap + nbitmap;
   // 数据块就是总块数-nmeta
   nblocks = FSSIZE - nmeta;
 
@@ -124,19 +131,24 @@ int main(int argc, char *argv[]) {
   sb.nblocks = xint(nblocks);
   // 200个inodes
   sb.ninodes = xint(NINODES);
-  // 30个块用作日志
+  // LOGSIZE个块用作日志
   sb.nlog = xint(nlog);
   // log块起始是2号块
   sb.logstart = xint(2);
   // inode块紧跟着log块
   sb.inodestart = xint(2 + nlog);
-  // 位图块跟着inode块
-  sb.bmapstart = xint(2 + nlog + ninodeblocks);
+  // inode位图块跟着inode块
+  sb.imapstart = xint(2 + nlog + ninodeblocks);
+  // 位图块跟着inode位图块
+  sb.bmapstart = xint(2 + nlog + ninodeblocks + nimap);
+  // 默认用有序日志模式
+  sb.flags = xint(FS_ORDERED);
   // 打印当前磁盘信息
   printf(
-      "nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) "
+      "nmeta %d (boot, super, log blocks %u inode blocks %u, inode bitmap "
+      "blocks %u, bitmap blocks %u) "
       "blocks %d total %d\n",
-      nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+      nmeta, nlog, ninodeblocks, nimap, nbitmap, nblocks, FSSIZE);
 
   // nmeta的值就是第一个空闲的数据块
   freeblock = nmeta;  // 可以开始分配数据的第一个block
@@ -157,19 +169,16 @@ int main(int argc, char *argv[]) {
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  // 创建名字为.的目录项并且放入根目录的inode中
-  bzero(&de, sizeof(de));
-  // 该目录项指向根目录本身
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  // 追加到inode管理的文件中
-  iappend(rootino, &de, sizeof(de));
+  // 根目录的项先攒起来 文件都拷贝完了再一起写
+  // 创建名字为.的目录项 该目录项指向根目录本身
+  nroot = 0;
+  bzero(rootents, sizeof(rootents));
+  rootents[nroot].inum = xshort(rootino);
+  strcpy(rootents[nroot++].name, ".");
 
   // ..目录也放进去
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootents[nroot].inum = xshort(rootino);
+  strcpy(rootents[nroot++].name, "..");
 
   // 拷贝其余参数文件
   for (i = 2; i < argc; i++) {
@@ -206,7 +215,8 @@ int main(int argc, char *argv[]) {
     }
 
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nroot < NINODES + 2);
+    rootents[nroot++] = de;
 
     // 每次读1024字节然后写入到inode表示的文件中
     while ((cc = read(fd, buf, sizeof(buf))) > 0) {
@@ -216,14 +226,10 @@ int main(int argc, char *argv[]) {
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off / BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirwrite(rootino, rootents, nroot);
 
   balloc(freeblock);
+  imapinit(freeinode);
 
   exit(0);
 }
@@ -293,7 +299,11 @@ uint ialloc(ushort type) {
   // bzero是C标准库 向地址写0
   bzero(&din, sizeof(din));
   // 设置有一个硬链接 后续会让一个文件夹inode item包含这里
-  din.type = xshort(type);
+  din.type = type;
+  // 普通文件按区段映射
+  if (type == T_FILE) {
+    din.flags = I_EXTENT;
+  }
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -303,6 +313,20 @@ uint ialloc(ushort type) {
 // 简单的位图映射 传入使用的块数
 // 假设块是按顺序覆盖的 给前used块设置为1
 // 目前只写入位图的第一个块
+// 写inode位图 前used个inode标记为已分配
+// 0号inode不用 也标记上 内核就不会分配到它
+void imapinit(int used) {
+  uchar buf[BSIZE];
+  int i;
+
+  assert(used < BSIZE * 8);
+  bzero(buf, BSIZE);
+  for (i = 0; i < used; i++) {
+    buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+  }
+  wsect(sb.imapstart, buf);
+}
+
 void balloc(int used) {
   uchar buf[BSIZE];
   int i;
@@ -329,12 +353,175 @@ void balloc(int used) {
 // 向inode中追加数据
 // 就是inode中的addr找到空闲的位置然后记录数据所在的块号
 // inum是inode号 xp是
+// 按区段映射的文件 找到第fbn个块的块号
+// 文件只会往后追加 没映射的块一定紧接着最后一个区段
+// freeblock正好接在最后一个区段后面的话 区段直接变长 否则新开一个区段
+uint efbmap(struct dinode *din, uint fbn) {
+  struct extent ext[NEXTPB + 1];  // 整个区段块 最后一项是ETAIL
+  struct extent *e, *last;
+  uint pos, x;
+  int i, n, inblk;
+
+  e = (struct extent *)din->addrs;
+  n = NIEXT;
+  inblk = 0;
+  last = 0;
+  pos = 0;
+  for (i = 0;; i++) {
+    if (i == n) {
+      // inode里的区段用完了 接着找区段块
+      if (inblk || xint(din->addrs[EXTBLK]) == 0) {
+        break;
+      }
+      rsect(xint(din->addrs[EXTBLK]), (char *)ext);
+      e = ext;
+      n = NEXTPB;
+      inblk = 1;
+      i = 0;
+    }
+    if (xint(e[i].len) == 0) {
+      break;
+    }
+    if (fbn - pos < xint(e[i].len)) {
+      return xint(e[i].start) + fbn - pos;
+    }
+    pos += xint(e[i].len);
+    last = &e[i];
+  }
+  assert(fbn == pos);
+
+  x = freeblock++;
+  if (last && xint(last->start) + xint(last->len) == x) {
+    last->len = xint(xint(last->len) + 1);
+  } else {
+    if (i == n && !inblk) {
+      // 分配区段块
+      din->addrs[EXTBLK] = xint(freeblock++);
+      memset(ext, 0, sizeof(ext));
+      e = ext;
+      n = NEXTPB;
+      inblk = 1;
+      i = 0;
+    }
+    assert(i < n);
+    e[i].start = xint(x);
+    e[i].len = xint(1);
+  }
+  // 区段块被改了 写回去 inode里的区段由调用者写回
+  if (inblk) {
+    wsect(xint(din->addrs[EXTBLK]), (char *)ext);
+  }
+  return x;
+}
+
+// 找到文件第fbn个块的块号
+// 沿途没有的间接索引块和数据块都从freeblock往后分配
+uint fbmap(struct dinode *din, uint fbn) {
+  uint indirect[NINDIRECT];
+  uint span, x, i;
+  int level;
+
+  if (din->flags & I_EXTENT) {
+    return efbmap(din, fbn);
+  }
+  if (fbn < NDIRECT) {
+    // 直接映射 如果当前的文件大小是1024的倍数 则addrs[fbn]应当是0
+    // 新占用一个data区的块 并且指过去
+    if (xint(din->addrs[fbn]) == 0) {
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  // 找出用第几级间接索引 span是这一级能管理的块数
+  span = NINDIRECT;
+  for (level = 1; fbn >= span; level++) {
+    assert(level < NLEVEL);
+    fbn -= span;
+    span *= NINDIRECT;
+  }
+  // 这一级的根索引块还没有 先分配一个
+  if (xint(din->addrs[NDIRECT + level - 1]) == 0) {
+    din->addrs[NDIRECT + level - 1] = xint(freeblock++);
+  }
+  x = xint(din->addrs[NDIRECT + level - 1]);
+  // 逐级读入索引块 缺了就分配并且把索引块写回
+  for (; level > 0; level--) {
+    span /= NINDIRECT;
+    rsect(x, (char *)indirect);
+    i = fbn / span;
+    fbn %= span;
+    if (indirect[i] == 0) {
+      indirect[i] = xint(freeblock++);
+      wsect(x, (char *)indirect);
+    }
+    x = xint(indirect[i]);
+  }
+  return x;
+}
+
+// 把n个文件夹项写成文件夹inum的内容 ents[0]和ents[1]是.和..
+// 一个块放得下就是普通的文件夹 补满一个块
+// 放不下就建哈希索引 取最小的depth让每个块都放得下
+void dirwrite(uint inum, struct dirent *ents, int n) {
+  char buf[BSIZE];
+  struct dinode din;
+  int depth, i, k, cnt[1 << HTMAXDEPTH];
+  uint mask;
+
+  if (n <= BSIZE / sizeof(struct dirent)) {
+    bzero(buf, sizeof(buf));
+    memmove(buf, ents, n * sizeof(struct dirent));
+    iappend(inum, buf, BSIZE);
+    return;
+  }
+
+  for (depth = 0;; depth++) {
+    if (depth > HTMAXDEPTH) {
+      die("dirwrite: directory too large");
+    }
+    mask = (1 << depth) - 1;
+    bzero(cnt, sizeof(cnt));
+    for (i = 2; i < n; i++) {
+      if (++cnt[dirhash(ents[i].name) & mask] > BSIZE / sizeof(struct dirent)) {
+        break;
+      }
+    }
+    if (i == n) {
+      break;
+    }
+  }
+
+  // 第0块 .和..后面是索引 哈希值低位为i的名字放在第i+1块
+  bzero(buf, sizeof(buf));
+  memmove(buf, ents, 2 * sizeof(struct dirent));
+  HTENT(buf, 0) = xshort(depth);
+  for (i = 0; i < (1 << depth); i++) {
+    HTENT(buf, 1 + i) = xshort(1 + i);
+  }
+  iappend(inum, buf, BSIZE);
+
+  for (i = 0; i < (1 << depth); i++) {
+    bzero(buf, sizeof(buf));
+    for (k = 0, cnt[i] = 0; k < n - 2; k++) {
+      if ((dirhash(ents[2 + k].name) & mask) == i) {
+        ((struct dirent *)buf)[cnt[i]++] = ents[2 + k];
+      }
+    }
+    iappend(inum, buf, BSIZE);
+  }
+
+  rinode(inum, &din);
+  din.flags |= I_HTREE;
+  winode(inum, &din);
+}
+
 void iappend(uint inum, void *xp, int n) {
   char *p = (char *)xp;
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   // 把inode读进来
@@ -346,36 +533,10 @@ void iappend(uint inum, void *xp, int n) {
   while (n > 0) {
     // 取到当前追加的内容要追加到inode管理的第fbn个block中
     fbn = off / BSIZE;
-    // MAXFILE是256+12 = 268 单文件只能放268个块 再多就不行了
+    // 单文件最多MAXFILE个块
     assert(fbn < MAXFILE);
-    if (fbn < NDIRECT) {
-      // 没有用到第13个地址 也就是没用到二级文件索引
-      if (xint(din.addrs[fbn]) == 0) {
-        // 如果当前的文件大小是1024的倍数 则addrs[fbn]应当是0
-        // 新占用一个data区的块 并且指过去
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      // x就是需要写到inode里面的块号
-      x = xint(din.addrs[fbn]);
-    } else {
-      // 如果addrs的前12个块都用了 即当前文件已经超过了 12kb
-      // 就用第13个字节指向的二级文件索引
-      if (xint(din.addrs[NDIRECT]) == 0) {
-        // 如果第13个块没有被用 先分配一个数据区的块让第13个地址指过去
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      // 把这个简介文件索引块读入
-      rsect(xint(din.addrs[NDIRECT]), (char *)indirect);
-      // 如果fbn是1024的倍数 这里需要新开一个空闲的数据块
-      if (indirect[fbn - NDIRECT] == 0) {
-        // 新分配数据块
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        // 让间接文件索引块先保存一下 因为有新的指向被分配了
-        wsect(xint(din.addrs[NDIRECT]), (char *)indirect);
-      }
-      // x是数据实际被写入的块号
-      x = xint(indirect[fbn - NDIRECT]);
-    }
+    // x是数据实际被写入的块号
+    x = fbmap(&din, fbn);
     // n是需要写入的字节数
     // 后面的参数是 当前块的剩余空间 写入的时候不能超过当前块
     // 剩余空间
@@ -21,11 +21,13 @@ char *fmtname(char *path) {
   return buf;
 }
 
+// 一次getdents最多读多少项
+#define NDENT 16
+
 // 传入路径
 void ls(char *path) {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n, i;
+  struct dirinfo de[NDENT];
   struct stat st;
 
   // 打开路径
@@ -50,32 +52,13 @@ void ls(char *path) {
     }
     case T_DIR: {
       // 如果是ls目录
-      // 路径长度检查
-      if (strlen(path) + 1 + DIRSIZ + 1 > sizeof buf) {
-        printf("ls: path too long\n");
-        break;
-      }
-      // 拷贝路径到buf
-      strcpy(buf, path);
-      p = buf + strlen(buf);
-      // 让文件夹以/结尾
-      *p++ = '/';
-      // 每次从文件中读一个dirent
-      while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-        if (de.inum == 0) {
-          continue;
-        }
-        // 把文件名拷贝到buf
-        memmove(p, de.name, DIRSIZ);
-        // 强制以\0结尾
-        p[DIRSIZ] = 0;
-        // 查看该文件的状态
-        if (stat(buf, &st) < 0) {
-          printf("ls: cannot stat %s\n", buf);
-          continue;
+      // 一次读一批文件夹项 每项已经带着类型和大小 不用再一个个stat
+      while ((n = getdents(fd, de, NDENT)) > 0) {
+        for (i = 0; i < n; i++) {
+          // 打印文件名 文件类型 文件inode 文件大小
+          printf("%s %d\t%d\t%d\n", fmtname(de[i].name), de[i].type,
+                 de[i].ino, (int)de[i].size);
         }
-        // 打印文件名 文件类型 文件inode 文件大小
-        printf("%s %d\t%d\t%d\n", fmtname(buf), st.type, st.ino, st.size);
       }
       break;
     }
@@ -0,0 +1,64 @@
+#include "includes/types.h"
+#include "includes/stat.h"
+#include "user/user.h"
+
+// 测量管道的吞吐量 子进程往管道里写 父进程读
+// 用法 pipebench [MB数] [每次读写的字节数]
+
+#define NBUF 8192
+
+char buf[NBUF];
+
+int main(int argc, char *argv[]) {
+  int fd[2];
+  int mb, sz, n, t0, t1, pid;
+  uint total, left, got;
+
+  mb = argc > 1 ? atoi(argv[1]) : 4;
+  sz = argc > 2 ? atoi(argv[2]) : 4096;
+  if (mb <= 0 || sz <= 0 || sz > NBUF) {
+    fprintf(2, "usage: pipebench [MB] [1-%d]\n", NBUF);
+    exit(1);
+  }
+  total = (uint)mb * 1024 * 1024;
+  if (pipe(fd) < 0) {
+    fprintf(2, "pipebench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if (pid < 0) {
+    fprintf(2, "pipebench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    for (left = total; left > 0; left -= n) {
+      n = left < sz ? left : sz;
+      if ((n = write(fd[1], buf, n)) <= 0) {
+        fprintf(2, "pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fd[1]);
+  got = 0;
+  while ((n = read(fd[0], buf, sz)) > 0) {
+    got += n;
+  }
+  wait(0);
+  t1 = uptime();
+  if (got != total) {
+    fprintf(2, "pipebench: got %d bytes, want %d\n", got, total);
+    exit(1);
+  }
+  // 一个时钟中断是0.1秒 结果保留一位小数
+  if (t1 == t0) {
+    t1 = t0 + 1;
+  }
+  n = mb * 100 / (t1 - t0);
+  printf("pipebench: %d MB in %d ticks, %d.%d MB/s\n", mb, t1 - t0, n / 10,
+         n % 10);
+  exit(0);
+}
@@ -1,4 +1,7 @@
 struct stat;
+struct dirinfo;
+struct iovec;
+struct ioring;
 
 // 系统调用函数 符号实际指向usys.S
 int fork(void);
@@ -22,6 +25,14 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getdents(int, struct dirinfo*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int ioring_setup(struct ioring*);
+int ioring_enter(int);
+int sendfile(int, int, int);
 
 // 标准库
 int stat(const char*, struct stat*);
@@ -28,3 +28,11 @@ entry("getpid")
 entry("sbrk")
 entry("sleep")
 entry("uptime")
+entry("getdents")
+entry("pread")
+entry("pwrite")
+entry("readv")
+entry("writev")
+entry("ioring_setup")
+entry("ioring_enter")
+entry("sendfile")